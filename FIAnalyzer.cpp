@@ -0,0 +1,269 @@
+// FIAnalyzer.cpp
+// Campaign results analyzer (fi-analyze)
+//
+// Replaces the grep/awk post-processing of analyze_llfi_samples.sh and
+// llfi-compare.sh. Reads one or more results stores written by
+// fi-campaign --results and aggregates outcomes per function (via the
+// fi-inject site map), per fault model and per detecting hardening
+// strategy. Coverage is detected / (detected + sdc): the share of faults
+// that would otherwise corrupt output silently and were caught.
+//
+// Usage:
+//   fi-analyze [--site-map sites.tsv] [--format csv|json] [-o out] results.firs...
+
+#include "FIResultsStore.h"
+#include "FIInjectionRuntime.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Aggregate {
+  uint64_t Counts[NUM_OUTCOMES] = {};
+  uint64_t LatencySum = 0;
+
+  uint64_t injected() const {
+    uint64_t N = 0;
+    for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O)
+      N += Counts[O];
+    return N;
+  }
+};
+
+// A named group of aggregates ("function", "model", "strategy")
+struct Table {
+  const char *Name;
+  std::vector<std::string> Keys;
+  std::vector<Aggregate> Rows;
+  std::map<std::string, size_t> Index;
+
+  size_t index(const std::string &Key) {
+    auto It = Index.emplace(Key, Rows.size());
+    if (It.second) {
+      Keys.push_back(Key);
+      Rows.emplace_back();
+    }
+    return It.first->second;
+  }
+};
+
+// Site ID -> function name, from the fi-inject site map
+bool loadFunctions(const std::string &Path, std::vector<std::string> &Functions) {
+  std::ifstream In(Path);
+  if (!In) {
+    fprintf(stderr, "fi-analyze: cannot open site map '%s'\n", Path.c_str());
+    return false;
+  }
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream Fields(Line);
+    std::string ID, Kind, Function;
+    std::getline(Fields, ID, '\t');
+    std::getline(Fields, Kind, '\t');
+    std::getline(Fields, Function, '\t');
+    unsigned long Site = strtoul(ID.c_str(), nullptr, 10);
+    if (Site >= Functions.size())
+      Functions.resize(Site + 1);
+    Functions[Site] = Function;
+  }
+  return true;
+}
+
+double coverage(const Aggregate &A, uint64_t Detected, uint64_t SDC) {
+  return Detected + SDC ? (double)A.Counts[OUTCOME_DETECTED] / (Detected + SDC) : 0.0;
+}
+
+double meanLatency(const Aggregate &A) {
+  uint64_t D = A.Counts[OUTCOME_DETECTED];
+  return D ? (double)A.LatencySum / D : 0.0;
+}
+
+void writeCSV(FILE *Out, std::vector<Table> &Tables) {
+  fprintf(Out, "table,key,injected");
+  for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O)
+    fprintf(Out, ",%s", outcomeName(O));
+  fprintf(Out, ",coverage,mean_latency\n");
+  for (Table &T : Tables) {
+    for (size_t I = 0; I < T.Rows.size(); ++I) {
+      const Aggregate &A = T.Rows[I];
+      // Strategy rows share the whole campaign's denominator
+      const Aggregate &Base = strcmp(T.Name, "strategy") ? A : Tables[0].Rows[0];
+      fprintf(Out, "%s,\"%s\",%llu", T.Name, T.Keys[I].c_str(),
+              (unsigned long long)Base.injected());
+      for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O)
+        fprintf(Out, ",%llu", (unsigned long long)A.Counts[O]);
+      fprintf(Out, ",%.6f,%.2f\n",
+              coverage(A, Base.Counts[OUTCOME_DETECTED], Base.Counts[OUTCOME_SDC]),
+              meanLatency(A));
+    }
+  }
+}
+
+void writeJSONString(FILE *Out, const std::string &S) {
+  fputc('"', Out);
+  for (char C : S) {
+    if (C == '"' || C == '\\')
+      fprintf(Out, "\\%c", C);
+    else if ((unsigned char)C < 0x20)
+      fprintf(Out, "\\u%04x", C);
+    else
+      fputc(C, Out);
+  }
+  fputc('"', Out);
+}
+
+void writeJSON(FILE *Out, std::vector<Table> &Tables, uint64_t Trials) {
+  fprintf(Out, "{\n  \"trials\": %llu", (unsigned long long)Trials);
+  for (Table &T : Tables) {
+    fprintf(Out, ",\n  \"%s\": [", T.Name);
+    for (size_t I = 0; I < T.Rows.size(); ++I) {
+      const Aggregate &A = T.Rows[I];
+      const Aggregate &Base = strcmp(T.Name, "strategy") ? A : Tables[0].Rows[0];
+      fprintf(Out, "%s\n    {\"key\": ", I ? "," : "");
+      writeJSONString(Out, T.Keys[I]);
+      fprintf(Out, ", \"injected\": %llu", (unsigned long long)Base.injected());
+      for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O)
+        fprintf(Out, ", \"%s\": %llu", outcomeName(O), (unsigned long long)A.Counts[O]);
+      fprintf(Out, ", \"coverage\": %.6f, \"mean_latency\": %.2f}",
+              coverage(A, Base.Counts[OUTCOME_DETECTED], Base.Counts[OUTCOME_SDC]),
+              meanLatency(A));
+    }
+    fprintf(Out, "\n  ]");
+  }
+  fprintf(Out, "\n}\n");
+}
+
+void printUsage() {
+  fprintf(stderr,
+          "Usage: fi-analyze [options] <results>...\n"
+          "  --site-map FILE      Site map written by -fi-inject-site-map\n"
+          "  --format csv|json    Output format (default csv)\n"
+          "  -o FILE              Write to FILE instead of stdout\n");
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  std::string SiteMapPath, OutputPath, Format = "csv";
+  std::vector<std::string> Inputs;
+  for (int I = 1; I < argc; ++I) {
+    std::string Arg = argv[I];
+    if (Arg == "--site-map" && I + 1 < argc)
+      SiteMapPath = argv[++I];
+    else if (Arg == "--format" && I + 1 < argc)
+      Format = argv[++I];
+    else if (Arg == "-o" && I + 1 < argc)
+      OutputPath = argv[++I];
+    else if (!Arg.empty() && Arg[0] == '-') {
+      printUsage();
+      return 2;
+    } else
+      Inputs.push_back(Arg);
+  }
+  if (Inputs.empty() || (Format != "csv" && Format != "json")) {
+    printUsage();
+    return 2;
+  }
+
+  std::vector<std::string> Functions;
+  if (!SiteMapPath.empty() && !loadFunctions(SiteMapPath, Functions))
+    return 2;
+
+  FIResultsTable Results;
+  for (const std::string &Path : Inputs) {
+    std::string Error;
+    if (!Results.load(Path, Error)) {
+      fprintf(stderr, "fi-analyze: %s\n", Error.c_str());
+      return 1;
+    }
+  }
+
+  // Tables[0] holds the campaign total, used as the strategy denominator
+  std::vector<Table> Tables = {{"total"}, {"function"}, {"model"}, {"strategy"}};
+  Table &Total = Tables[0], &ByFunction = Tables[1], &ByModel = Tables[2],
+        &ByStrategy = Tables[3];
+  Total.index("all");
+
+  // Dense site -> row index so the hot loop never hashes strings
+  std::vector<size_t> SiteRow(Functions.size());
+  for (size_t S = 0; S < Functions.size(); ++S)
+    SiteRow[S] = ByFunction.index(Functions[S].empty() ? "unknown" : Functions[S]);
+  size_t UnknownRow = ByFunction.index("unknown");
+  size_t ModelRow[256];
+  for (uint32_t M = 0; M < 256; ++M)
+    ModelRow[M] = ByModel.index(modelName(M));
+  std::map<uint32_t, size_t> StrategyRow;
+
+  uint64_t NotInjected = 0;
+  for (size_t I = 0, E = Results.size(); I < E; ++I) {
+    uint8_t O = Results.Outcomes[I];
+    if (O >= NUM_OUTCOMES)
+      continue;
+    if (O == OUTCOME_NOT_INJECTED) {
+      NotInjected++;
+      continue;
+    }
+    uint32_t Site = Results.Sites[I];
+    uint64_t Latency = O == OUTCOME_DETECTED ? Results.Latencies[I] : 0;
+    Aggregate *Targets[3] = {
+        &Total.Rows[0],
+        &ByFunction.Rows[Site < SiteRow.size() ? SiteRow[Site] : UnknownRow],
+        &ByModel.Rows[ModelRow[Results.Models[I]]]};
+    for (Aggregate *A : Targets) {
+      A->Counts[O]++;
+      A->LatencySum += Latency;
+    }
+
+    if (O == OUTCOME_DETECTED) {
+      uint32_t ID = Results.Detections[I];
+      auto It = StrategyRow.find(ID);
+      if (It == StrategyRow.end()) {
+        // Strategy = check type, the part before the tab
+        auto Name = Results.DetectionNames.find(ID);
+        std::string Type = Name == Results.DetectionNames.end()
+                               ? "unknown"
+                               : Name->second.substr(0, Name->second.find('\t'));
+        It = StrategyRow.emplace(ID, ByStrategy.index(Type)).first;
+      }
+      Aggregate &A = ByStrategy.Rows[It->second];
+      A.Counts[O]++;
+      A.LatencySum += Latency;
+    }
+  }
+
+  // Drop rows nothing landed in (unreached functions, unused models)
+  for (Table &T : Tables) {
+    Table Kept{T.Name};
+    for (size_t I = 0; I < T.Rows.size(); ++I)
+      if (T.Rows[I].injected() || &T == &Total) {
+        Kept.Keys.push_back(T.Keys[I]);
+        Kept.Rows.push_back(T.Rows[I]);
+      }
+    T = Kept;
+  }
+
+  FILE *Out = stdout;
+  if (!OutputPath.empty() && !(Out = fopen(OutputPath.c_str(), "w"))) {
+    fprintf(stderr, "fi-analyze: cannot write '%s'\n", OutputPath.c_str());
+    return 1;
+  }
+  if (Format == "json")
+    writeJSON(Out, Tables, Results.size());
+  else
+    writeCSV(Out, Tables);
+  if (Out != stdout)
+    fclose(Out);
+
+  fprintf(stderr, "fi-analyze: %zu trials (%llu not injected) from %zu file(s)\n",
+          Results.size(), (unsigned long long)NotInjected, Inputs.size());
+  return 0;
+}
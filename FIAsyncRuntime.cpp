@@ -0,0 +1,250 @@
+// FIAsyncRuntime.cpp
+// Asynchronous (SRMT-style) checking for -fi-harden-async builds
+//
+// Every application thread owns a lock-free single-producer/single-consumer
+// ring. The fi_async_* entry points append a record and return at once; a
+// trailing checker thread, started on first use, drains all rings, compares
+// master and shadow values or recomputes the queued operation, and reports
+// mismatches through the usual fi_mismatch_* failure paths, which abort or
+// exit the whole process. fi_async_sync() and an atexit handler wait until
+// the rings are drained, so no unchecked value is committed as output.
+
+#include "FIHardeningRuntime.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+namespace {
+
+// Record kinds; the fi_async_op_t values are recomputed operations
+enum : uint32_t {
+  COMPARE_INT32 = 16,
+  COMPARE_INT64,
+  COMPARE_POINTER,
+  COMPARE_BRANCH
+};
+
+struct Record {
+  uint64_t A;        // Master value, or left operand
+  uint64_t B;        // Shadow value, or right operand
+  uint64_t Result;   // Result of a recomputed operation
+  const char *Location;
+  uint32_t Kind;
+  uint32_t Width;
+};
+
+const uint32_t RingSize = 4096;  // Records per thread, a power of two
+const uint32_t MaxThreads = 256;
+
+struct Ring {
+  alignas(64) std::atomic<uint32_t> Head{0};  // Written by the application thread
+  alignas(64) std::atomic<uint32_t> Tail{0};  // Written by the checker
+  Record Records[RingSize];
+};
+
+Ring *g_rings[MaxThreads];
+std::atomic<uint32_t> g_ring_count{0};
+pthread_mutex_t g_register_lock = PTHREAD_MUTEX_INITIALIZER;
+std::atomic<bool> g_checker_started{false};
+thread_local Ring *t_ring = nullptr;
+
+int64_t signExtend(uint64_t V, uint32_t Width) {
+  return Width >= 64 ? (int64_t)V : (int64_t)(V << (64 - Width)) >> (64 - Width);
+}
+
+// Recompute a queued operation; false if its operands cannot have produced
+// a result (a zero divisor or signed overflow, so they were corrupted)
+bool recompute(const Record &R, uint64_t &Out) {
+  uint64_t Mask = R.Width >= 64 ? ~0ull : (1ull << R.Width) - 1;
+  uint64_t L = R.A & Mask, Rhs = R.B & Mask;
+  if (Rhs == 0)
+    return false;
+  switch (R.Kind) {
+  case FI_ASYNC_UDIV:
+    Out = L / Rhs;
+    return true;
+  case FI_ASYNC_UREM:
+    Out = L % Rhs;
+    return true;
+  case FI_ASYNC_SDIV:
+  case FI_ASYNC_SREM: {
+    int64_t SL = signExtend(L, R.Width), SR = signExtend(Rhs, R.Width);
+    if (SR == -1 && SL == signExtend(1ull << (R.Width - 1), R.Width))
+      return false;
+    Out = (uint64_t)(R.Kind == FI_ASYNC_SDIV ? SL / SR : SL % SR) & Mask;
+    return true;
+  }
+  }
+  return false;
+}
+
+void check(const Record &R) {
+  fi_count_verification(FI_VERIFY_ASYNC);
+  switch (R.Kind) {
+  case COMPARE_INT32:
+    if ((int32_t)R.A != (int32_t)R.B)
+      fi_mismatch_int32((int32_t)R.A, (int32_t)R.B, R.Location);
+    return;
+  case COMPARE_INT64:
+    if (R.A != R.B)
+      fi_mismatch_int64((int64_t)R.A, (int64_t)R.B, R.Location);
+    return;
+  case COMPARE_POINTER:
+    if (R.A != R.B)
+      fi_mismatch_pointer((void *)(uintptr_t)R.A, (void *)(uintptr_t)R.B, R.Location);
+    return;
+  case COMPARE_BRANCH:
+    if ((int)R.A != (int)R.B)
+      fi_mismatch_branch((int)R.A, (int)R.B, R.Location);
+    return;
+  }
+  uint64_t Expected = 0;
+  if (!recompute(R, Expected) || Expected != R.Result)
+    fi_mismatch_int64((int64_t)R.Result, (int64_t)Expected, R.Location);
+}
+
+// Drain every ring; true if anything was checked
+bool drainAll() {
+  bool Work = false;
+  uint32_t N = g_ring_count.load(std::memory_order_acquire);
+  for (uint32_t I = 0; I < N; ++I) {
+    Ring *R = g_rings[I];
+    uint32_t T = R->Tail.load(std::memory_order_relaxed);
+    uint32_t H = R->Head.load(std::memory_order_acquire);
+    if (T == H)
+      continue;
+    for (; T != H; ++T)
+      check(R->Records[T & (RingSize - 1)]);
+    R->Tail.store(T, std::memory_order_release);
+    Work = true;
+  }
+  return Work;
+}
+
+void *checkerMain(void *) {
+  unsigned Idle = 0;
+  for (;;) {
+    if (drainAll()) {
+      Idle = 0;
+      continue;
+    }
+    // Spin while work is likely, then back off so an idle checker does not
+    // hold a core
+    if (++Idle < 1024) {
+      sched_yield();
+    } else {
+      struct timespec Nap = {0, 50000};
+      nanosleep(&Nap, nullptr);
+    }
+  }
+  return nullptr;
+}
+
+// Wait until every queued record has been checked
+void waitForAll() {
+  uint32_t N = g_ring_count.load(std::memory_order_acquire);
+  for (uint32_t I = 0; I < N; ++I) {
+    Ring *R = g_rings[I];
+    uint32_t H = R->Head.load(std::memory_order_acquire);
+    while (R->Tail.load(std::memory_order_acquire) != H)
+      sched_yield();
+  }
+}
+
+// The checker thread does not survive fork(); the child starts its own and
+// checks whatever the parent left queued
+void resetAfterFork() {
+  g_checker_started.store(false, std::memory_order_relaxed);
+}
+
+void startChecker() {
+  if (g_checker_started.exchange(true))
+    return;
+  static bool Registered = false;
+  if (!Registered) {
+    Registered = true;
+    pthread_atfork(nullptr, nullptr, resetAfterFork);
+    atexit(waitForAll);
+  }
+  pthread_t Thread;
+  pthread_attr_t Attr;
+  pthread_attr_init(&Attr);
+  pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&Thread, &Attr, checkerMain, nullptr) != 0) {
+    fprintf(stderr, "[FI-Async] Cannot start checker thread\n");
+    abort();
+  }
+  pthread_attr_destroy(&Attr);
+}
+
+// The calling thread's ring, or null once MaxThreads threads registered
+// (those threads are checked inline)
+Ring *threadRing() {
+  if (t_ring)
+    return t_ring;
+  pthread_mutex_lock(&g_register_lock);
+  uint32_t N = g_ring_count.load(std::memory_order_relaxed);
+  if (N < MaxThreads) {
+    t_ring = new Ring();
+    g_rings[N] = t_ring;
+    g_ring_count.store(N + 1, std::memory_order_release);
+  }
+  pthread_mutex_unlock(&g_register_lock);
+  return t_ring;
+}
+
+void push(uint32_t Kind, uint32_t Width, uint64_t A, uint64_t B,
+          uint64_t Result, const char *Location) {
+  Record Rec = {A, B, Result, Location, Kind, Width};
+  if (!g_checker_started.load(std::memory_order_relaxed))
+    startChecker();
+  Ring *R = threadRing();
+  if (!R) {
+    check(Rec);
+    return;
+  }
+  uint32_t H = R->Head.load(std::memory_order_relaxed);
+  // Full: the checker is behind, so wait for it rather than drop checks
+  while (H - R->Tail.load(std::memory_order_acquire) >= RingSize)
+    sched_yield();
+  R->Records[H & (RingSize - 1)] = Rec;
+  R->Head.store(H + 1, std::memory_order_release);
+}
+
+} // anonymous namespace
+
+void fi_async_verify_int32(int32_t value, int32_t expected, const char *location) {
+  push(COMPARE_INT32, 32, (uint32_t)value, (uint32_t)expected, 0, location);
+}
+
+void fi_async_verify_int64(int64_t value, int64_t expected, const char *location) {
+  push(COMPARE_INT64, 64, (uint64_t)value, (uint64_t)expected, 0, location);
+}
+
+void fi_async_verify_pointer(void *ptr, void *expected, const char *location) {
+  push(COMPARE_POINTER, 64, (uintptr_t)ptr, (uintptr_t)expected, 0, location);
+}
+
+void fi_async_verify_branch(int condition, int expected, const char *location) {
+  push(COMPARE_BRANCH, 32, (uint32_t)condition, (uint32_t)expected, 0, location);
+}
+
+void fi_async_check_op(uint32_t op, uint32_t width, uint64_t lhs, uint64_t rhs,
+                       uint64_t result, const char *location) {
+  push(op, width, lhs, rhs, result, location);
+}
+
+void fi_async_sync(void) {
+  Ring *R = t_ring;
+  if (!R)
+    return;
+  if (!g_checker_started.load(std::memory_order_relaxed))
+    startChecker();
+  uint32_t H = R->Head.load(std::memory_order_relaxed);
+  while (R->Tail.load(std::memory_order_acquire) != H)
+    sched_yield();
+}
@@ -0,0 +1,1019 @@
+// FICampaignRunner.cpp
+// Fork-server fault injection campaign runner (fi-campaign)
+//
+// Replaces the per-trial re-execution of scripts/llfi-run.sh. The target
+// (built with the fi-inject pass and linked with libFIHardeningRuntime.a)
+// is started once and pauses before main(); every trial is a fork() of
+// that snapshot with a different injection target. See the fork server
+// protocol in FIInjectionRuntime.h.
+//
+// Trials are scheduled over one fork server per worker (--jobs, default
+// all CPUs), each pinned to its own CPU. A timerfd per worker bounds every
+// trial; trials that exceed it are killed and classified as hangs.
+//
+// With --profile, a fault-free profiling run counts how often every site
+// executes, and trials sample (site, instance) uniformly over those dynamic
+// executions. With --margin, the campaign stops once the Wilson confidence
+// interval of every outcome rate is narrower than the target margin.
+//
+// Each fork server keeps the golden run's output trace; trials stop as soon
+// as their stdout diverges from it (see FIInjectionRuntime.h), and only the
+// golden output's length and hash are kept for the final comparison.
+//
+// --top-uncertain N restricts the campaign to the N sites whose static SDC
+// propensity (from the site map) is closest to 0.5.
+//
+// --models mixes fault models: every trial draws one of the listed models
+// that applies to its site's kind (value, store or branch). Without it each
+// kind uses its classic model (bit flip, store skip, branch inversion).
+//
+// --self-test runs a -fi-harden-self-test build once per shadow site (from
+// -fi-harden-self-test-map), corrupting only that shadow copy, and lists
+// the sites whose checks did not fire and those whose shadow the optimizer
+// removed (kind "shadow-optimized").
+//
+// Usage:
+//   fi-campaign --site-map sites.tsv [--trials N] [options] -- ./program args...
+
+#include "FIInjectionRuntime.h"
+#include "FIHardeningRuntime.h"
+#include "FIResultsStore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// One line of the fi-inject site map
+struct SiteInfo {
+  uint32_t ID = 0;
+  std::string Kind;
+  std::string Function;
+  std::string Opcode;
+  unsigned Width = 0;
+  std::string Location;
+  uint64_t Count = 0;  // Dynamic executions in the profiling run
+  double SDC = -1;     // Static SDC propensity from the site map, -1 if absent
+};
+
+bool loadSiteMap(const std::string &Path, std::vector<SiteInfo> &Sites) {
+  std::ifstream In(Path);
+  if (!In) {
+    fprintf(stderr, "fi-campaign: cannot open site map '%s'\n", Path.c_str());
+    return false;
+  }
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream Fields(Line);
+    SiteInfo Site;
+    std::string ID, Width, SDC;
+    std::getline(Fields, ID, '\t');
+    std::getline(Fields, Site.Kind, '\t');
+    std::getline(Fields, Site.Function, '\t');
+    std::getline(Fields, Site.Opcode, '\t');
+    std::getline(Fields, Width, '\t');
+    std::getline(Fields, Site.Location, '\t');
+    if (std::getline(Fields, SDC, '\t') && !SDC.empty())
+      Site.SDC = strtod(SDC.c_str(), nullptr);
+    Site.ID = (uint32_t)strtoul(ID.c_str(), nullptr, 10);
+    Site.Width = (unsigned)strtoul(Width.c_str(), nullptr, 10);
+    Sites.push_back(Site);
+  }
+  return true;
+}
+
+uint32_t modelForKind(const std::string &Kind) {
+  if (Kind == "store")
+    return FI_FAULT_SKIP;
+  if (Kind == "branch")
+    return FI_FAULT_BRANCH_INVERT;
+  if (Kind == "shadow")
+    return FI_FAULT_SHADOW;
+  return FI_FAULT_BITFLIP;
+}
+
+// Whether the fi-inject hook for Kind implements Model
+bool modelAppliesTo(uint32_t Model, const std::string &Kind) {
+  if (Kind == "store")
+    return Model == FI_FAULT_SKIP;
+  if (Kind == "branch")
+    return Model == FI_FAULT_BRANCH_INVERT || Model == FI_FAULT_SKIP;
+  if (Kind == "shadow")
+    return Model == FI_FAULT_SHADOW;
+  return Model == FI_FAULT_BITFLIP || Model == FI_FAULT_SKIP ||
+         Model == FI_FAULT_DOUBLE_BIT || Model == FI_FAULT_BYTE_BURST;
+}
+
+// Parses a --models list ("bitflip,double-bit,byte-burst,skip,branch")
+bool parseModels(const char *List, std::vector<uint32_t> &Models) {
+  std::istringstream Names(List);
+  std::string Name;
+  while (std::getline(Names, Name, ',')) {
+    uint32_t Model = FI_FAULT_NONE;
+    for (uint32_t M = FI_FAULT_BITFLIP; M <= FI_FAULT_BYTE_BURST; ++M)
+      if (M != FI_FAULT_SHADOW && Name == modelName(M))
+        Model = M;
+    if (Model == FI_FAULT_NONE) {
+      fprintf(stderr, "fi-campaign: unknown fault model '%s'\n", Name.c_str());
+      return false;
+    }
+    Models.push_back(Model);
+  }
+  return !Models.empty();
+}
+
+// SplitMix64: cheap, seedable per trial so results do not depend on which
+// worker runs which trial
+uint64_t splitMix64(uint64_t &State) {
+  uint64_t Z = (State += 0x9E3779B97F4A7C15ull);
+  Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBull;
+  return Z ^ (Z >> 31);
+}
+
+// Length and FNV-1a hash of a trial's stdout
+struct OutputDigest {
+  uint64_t Length = 0;
+  uint64_t Hash = 0xcbf29ce484222325ull;
+
+  bool operator==(const OutputDigest &Other) const {
+    return Length == Other.Length && Hash == Other.Hash;
+  }
+  bool operator!=(const OutputDigest &Other) const { return !(*this == Other); }
+};
+
+bool readFull(int Fd, void *Buf, size_t Size) {
+  size_t Done = 0;
+  while (Done < Size) {
+    ssize_t N = read(Fd, (char *)Buf + Done, Size - Done);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Done += (size_t)N;
+  }
+  return true;
+}
+
+bool writeFull(int Fd, const void *Buf, size_t Size) {
+  size_t Done = 0;
+  while (Done < Size) {
+    ssize_t N = write(Fd, (const char *)Buf + Done, Size - Done);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Done += (size_t)N;
+  }
+  return true;
+}
+
+// A target process paused at main(), forking one child per trial
+class ForkServer {
+  pid_t Pid = -1;
+  int CtlFd = -1;
+  int StFd = -1;
+  int OutFd = -1;  // Runner side of the target's stdout capture file
+  int TimerFd = -1;
+  std::string OutPath;
+
+public:
+  ~ForkServer() { stop(); }
+
+  // Cpu < 0 leaves the affinity unchanged. All descriptors are close-on-exec
+  // so servers started for other workers never inherit them.
+  bool start(const std::vector<char *> &Argv, const std::string &StdinPath,
+             bool ShowStderr, int Cpu) {
+    char Template[] = "/tmp/fi-campaign-out.XXXXXX";
+    OutFd = mkostemp(Template, O_CLOEXEC);
+    if (OutFd < 0) {
+      perror("fi-campaign: mkostemp");
+      return false;
+    }
+    OutPath = Template;
+
+    TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (TimerFd < 0) {
+      perror("fi-campaign: timerfd_create");
+      return false;
+    }
+
+    int Ctl[2], St[2];
+    if (pipe2(Ctl, O_CLOEXEC) || pipe2(St, O_CLOEXEC)) {
+      perror("fi-campaign: pipe");
+      return false;
+    }
+
+    Pid = fork();
+    if (Pid < 0) {
+      perror("fi-campaign: fork");
+      return false;
+    }
+
+    if (Pid == 0) {
+      // O_APPEND: every trial writes from the start of the truncated file
+      // Readable too: output checkpoints hash stdout as it is written
+      int Out = open(OutPath.c_str(), O_RDWR | O_APPEND);
+      int In = open(StdinPath.empty() ? "/dev/null" : StdinPath.c_str(), O_RDONLY);
+      if (Out < 0 || In < 0)
+        _exit(127);
+      dup2(Out, STDOUT_FILENO);
+      dup2(In, STDIN_FILENO);
+      if (!ShowStderr) {
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, STDERR_FILENO);
+      }
+      dup2(Ctl[0], FI_FORKSRV_CTL_FD);
+      dup2(St[1], FI_FORKSRV_ST_FD);
+      if (Cpu >= 0) {
+        cpu_set_t Set;
+        CPU_ZERO(&Set);
+        CPU_SET(Cpu, &Set);
+        sched_setaffinity(0, sizeof(Set), &Set);
+      }
+      setenv("FI_FORKSERVER", "1", 1);
+      execv(Argv[0], Argv.data());
+      _exit(127);
+    }
+
+    close(Ctl[0]);
+    close(St[1]);
+    CtlFd = Ctl[1];
+    StFd = St[0];
+
+    uint32_t Hello = 0;
+    if (!readFull(StFd, &Hello, sizeof(Hello)) || Hello != FI_FORKSRV_HELLO) {
+      fprintf(stderr, "fi-campaign: '%s' did not start the fork server "
+                      "(is it linked with libFIHardeningRuntime.a?)\n", Argv[0]);
+      return false;
+    }
+    return true;
+  }
+
+  // Run one trial; Output receives the digest of everything the trial wrote
+  // to stdout. A trial still running after TimeoutMs is killed and TimedOut
+  // is set.
+  bool runTrial(const fi_trial_request_t &Request, fi_trial_result_t &Result,
+                OutputDigest &Output, unsigned TimeoutMs, bool &TimedOut) {
+    TimedOut = false;
+    if (ftruncate(OutFd, 0) != 0)
+      return false;
+    if (!writeFull(CtlFd, &Request, sizeof(Request)))
+      return false;
+    int32_t Child = 0;
+    if (!readFull(StFd, &Child, sizeof(Child)))
+      return false;
+
+    if (TimeoutMs) {
+      struct itimerspec Spec = {};
+      Spec.it_value.tv_sec = TimeoutMs / 1000;
+      Spec.it_value.tv_nsec = (long)(TimeoutMs % 1000) * 1000000L;
+      timerfd_settime(TimerFd, 0, &Spec, nullptr);
+
+      struct pollfd Fds[2] = {{StFd, POLLIN, 0}, {TimerFd, POLLIN, 0}};
+      for (;;) {
+        int N = poll(Fds, 2, -1);
+        if (N < 0 && errno == EINTR)
+          continue;
+        if (N < 0)
+          return false;
+        if (Fds[0].revents)
+          break;
+        if (Fds[1].revents & POLLIN) {
+          uint64_t Expirations;
+          if (read(TimerFd, &Expirations, sizeof(Expirations)) < 0) {}
+          kill((pid_t)Child, SIGKILL);
+          TimedOut = true;
+          break;
+        }
+      }
+
+      struct itimerspec Disarm = {};
+      timerfd_settime(TimerFd, 0, &Disarm, nullptr);
+    }
+
+    if (!readFull(StFd, &Result, sizeof(Result)))
+      return false;
+    // A timeout that raced with a normal exit is not a hang
+    if (TimedOut && !(WIFSIGNALED(Result.status) &&
+                      WTERMSIG(Result.status) == SIGKILL))
+      TimedOut = false;
+
+    // Diverged trials are already classified; their output is irrelevant
+    Output = OutputDigest();
+    if (Result.diverged)
+      return true;
+    char Buf[65536];
+    for (;;) {
+      ssize_t N = pread(OutFd, Buf, sizeof(Buf), (off_t)Output.Length);
+      if (N < 0 && errno == EINTR)
+        continue;
+      if (N < 0)
+        return false;
+      if (N == 0)
+        return true;
+      for (ssize_t I = 0; I < N; ++I)
+        Output.Hash = (Output.Hash ^ (unsigned char)Buf[I]) * 0x100000001b3ull;
+      Output.Length += (uint64_t)N;
+    }
+  }
+
+  void stop() {
+    if (CtlFd >= 0)
+      close(CtlFd);
+    if (StFd >= 0)
+      close(StFd);
+    if (Pid > 0) {
+      kill(Pid, SIGKILL);
+      waitpid(Pid, nullptr, 0);
+    }
+    if (OutFd >= 0) {
+      close(OutFd);
+      unlink(OutPath.c_str());
+    }
+    if (TimerFd >= 0)
+      close(TimerFd);
+    CtlFd = StFd = OutFd = TimerFd = -1;
+    Pid = -1;
+  }
+};
+
+struct CampaignOptions {
+  std::string SiteMapPath;
+  std::string StdinPath;
+  std::string ResultsPath;
+  unsigned Trials = 100;
+  bool TrialsGiven = false;
+  bool Profile = false;
+  double Margin = 0;         // 0 = run all trials
+  double Confidence = 0.95;
+  uint64_t MaxInstance = 1;
+  uint32_t Seed = 1;
+  unsigned Jobs = 0;       // 0 = one worker per available CPU
+  unsigned TimeoutMs = 0;  // 0 = derived from the golden run
+  bool Pin = true;
+  bool SelfTest = false;
+  uint64_t Pattern = 1;
+  unsigned TopUncertain = 0;     // 0 = every site
+  std::vector<uint32_t> Models;  // Empty = one classic model per site kind
+  bool Verbose = false;
+  bool ShowStderr = false;
+  // Single-trial mode
+  long Site = -1;
+  uint64_t Instance = 1;
+  uint32_t Bit = 0;
+  std::vector<char *> TargetArgv;
+};
+
+void printUsage() {
+  fprintf(stderr,
+          "Usage: fi-campaign [options] -- <program> [args...]\n"
+          "  --site-map FILE      Site map written by -fi-inject-site-map\n"
+          "  --trials N           Number of random trials (default 100)\n"
+          "  --max-instance K     Sample dynamic instances from 1..K (default 1)\n"
+          "  --seed S             Random seed (default 1)\n"
+          "  --profile            Weight sites by dynamic execution count from a\n"
+          "                       profiling run (instances cover the whole run)\n"
+          "  --margin M           Stop once every outcome rate is known to +/-M\n"
+          "                       (--trials becomes the cap, default 1000000)\n"
+          "  --confidence C       Confidence level for intervals (default 0.95)\n"
+          "  --jobs J             Parallel workers (default: all CPUs)\n"
+          "  --timeout-ms T       Per-trial timeout (default: 10x golden run, min 100)\n"
+          "  --no-pin             Do not pin workers to CPUs\n"
+          "  --self-test          Corrupt every shadow site of a self-test build once\n"
+          "  --pattern P          XOR pattern for --self-test (default 1)\n"
+          "  --top-uncertain N    Only inject the N sites whose static SDC estimate\n"
+          "                       is least certain (closest to 0.5)\n"
+          "  --models LIST        Fault models to mix: bitflip, double-bit,\n"
+          "                       byte-burst, skip, branch\n"
+          "  --site ID            Run a single trial at this site\n"
+          "  --instance K         Dynamic instance for --site (default 1)\n"
+          "  --bit B              Bit to flip for --site (default 0)\n"
+          "  --results FILE       Append every trial to a results store (fi-analyze)\n"
+          "  --stdin FILE         Feed FILE to the program's stdin\n"
+          "  --show-stderr        Do not silence the program's stderr\n"
+          "  --verbose            Print every trial\n");
+}
+
+bool parseOptions(int argc, char **argv, CampaignOptions &Opts) {
+  int I = 1;
+  for (; I < argc; ++I) {
+    std::string Arg = argv[I];
+    auto Next = [&]() -> const char * {
+      return I + 1 < argc ? argv[++I] : nullptr;
+    };
+    const char *Val = nullptr;
+    if (Arg == "--") {
+      ++I;
+      break;
+    } else if (Arg == "--site-map" && (Val = Next())) {
+      Opts.SiteMapPath = Val;
+    } else if (Arg == "--trials" && (Val = Next())) {
+      Opts.Trials = (unsigned)strtoul(Val, nullptr, 0);
+      Opts.TrialsGiven = true;
+    } else if (Arg == "--profile") {
+      Opts.Profile = true;
+    } else if (Arg == "--margin" && (Val = Next())) {
+      Opts.Margin = strtod(Val, nullptr);
+    } else if (Arg == "--confidence" && (Val = Next())) {
+      Opts.Confidence = strtod(Val, nullptr);
+    } else if (Arg == "--max-instance" && (Val = Next())) {
+      Opts.MaxInstance = strtoull(Val, nullptr, 0);
+    } else if (Arg == "--seed" && (Val = Next())) {
+      Opts.Seed = (uint32_t)strtoul(Val, nullptr, 0);
+    } else if (Arg == "--jobs" && (Val = Next())) {
+      Opts.Jobs = (unsigned)strtoul(Val, nullptr, 0);
+    } else if (Arg == "--timeout-ms" && (Val = Next())) {
+      Opts.TimeoutMs = (unsigned)strtoul(Val, nullptr, 0);
+    } else if (Arg == "--no-pin") {
+      Opts.Pin = false;
+    } else if (Arg == "--self-test") {
+      Opts.SelfTest = true;
+    } else if (Arg == "--pattern" && (Val = Next())) {
+      Opts.Pattern = strtoull(Val, nullptr, 0);
+    } else if (Arg == "--top-uncertain" && (Val = Next())) {
+      Opts.TopUncertain = (unsigned)strtoul(Val, nullptr, 0);
+    } else if (Arg == "--models" && (Val = Next())) {
+      if (!parseModels(Val, Opts.Models))
+        return false;
+    } else if (Arg == "--site" && (Val = Next())) {
+      Opts.Site = strtol(Val, nullptr, 0);
+    } else if (Arg == "--instance" && (Val = Next())) {
+      Opts.Instance = strtoull(Val, nullptr, 0);
+    } else if (Arg == "--bit" && (Val = Next())) {
+      Opts.Bit = (uint32_t)strtoul(Val, nullptr, 0);
+    } else if (Arg == "--results" && (Val = Next())) {
+      Opts.ResultsPath = Val;
+    } else if (Arg == "--stdin" && (Val = Next())) {
+      Opts.StdinPath = Val;
+    } else if (Arg == "--show-stderr") {
+      Opts.ShowStderr = true;
+    } else if (Arg == "--verbose") {
+      Opts.Verbose = true;
+    } else {
+      fprintf(stderr, "fi-campaign: unknown or incomplete option '%s'\n", Arg.c_str());
+      return false;
+    }
+  }
+  if (Opts.Confidence <= 0 || Opts.Confidence >= 1) {
+    fprintf(stderr, "fi-campaign: --confidence must be in (0, 1)\n");
+    return false;
+  }
+  if (Opts.Margin > 0 && !Opts.TrialsGiven)
+    Opts.Trials = 1000000;
+  for (; I < argc; ++I)
+    Opts.TargetArgv.push_back(argv[I]);
+  Opts.TargetArgv.push_back(nullptr);
+  return Opts.TargetArgv.size() > 1;
+}
+
+// Classify by exit status, terminating signal and output comparison
+int classify(const fi_trial_result_t &Result, bool TimedOut,
+             const OutputDigest &Output, const fi_trial_result_t &Golden,
+             const OutputDigest &GoldenOutput) {
+  if (!Result.injected)
+    return OUTCOME_NOT_INJECTED;
+  if (TimedOut)
+    return OUTCOME_HANG;
+  if (Result.diverged)
+    return OUTCOME_SDC;
+  if (WIFSIGNALED(Result.status))
+    return OUTCOME_CRASH;
+  if (Result.detected || (WIFEXITED(Result.status) &&
+                          WEXITSTATUS(Result.status) == FI_DETECTED_EXIT_CODE))
+    return OUTCOME_DETECTED;
+  if (Result.status != Golden.status || Output != GoldenOutput)
+    return OUTCOME_SDC;
+  return OUTCOME_MASKED;
+}
+
+// Keep the Opts.TopUncertain sites whose static SDC estimate p has the
+// largest p * (1 - p): sites the analysis is confident about (almost surely
+// masked or almost surely SDC) gain the least from injection
+bool selectUncertainSites(const CampaignOptions &Opts, std::vector<SiteInfo> &Sites) {
+  for (const SiteInfo &S : Sites) {
+    if (S.SDC < 0) {
+      fprintf(stderr, "fi-campaign: --top-uncertain needs a site map with SDC "
+                      "estimates (site %u has none)\n", S.ID);
+      return false;
+    }
+  }
+  if (Sites.size() <= Opts.TopUncertain)
+    return true;
+  std::stable_sort(Sites.begin(), Sites.end(), [](const SiteInfo &A, const SiteInfo &B) {
+    return A.SDC * (1 - A.SDC) > B.SDC * (1 - B.SDC);
+  });
+  Sites.resize(Opts.TopUncertain);
+  std::sort(Sites.begin(), Sites.end(),
+            [](const SiteInfo &A, const SiteInfo &B) { return A.ID < B.ID; });
+  return true;
+}
+
+// Run the target once outside the fork server with FI_PROFILE_OUT set and
+// record each site's dynamic execution count. FI_FORKSERVER_DEFERRED stays
+// set, so the counts start at fi_forkserver_checkpoint() like the trials'.
+bool runProfile(const CampaignOptions &Opts, std::vector<SiteInfo> &Sites) {
+  char Template[] = "/tmp/fi-campaign-profile.XXXXXX";
+  int Fd = mkostemp(Template, O_CLOEXEC);
+  if (Fd < 0) {
+    perror("fi-campaign: mkostemp");
+    return false;
+  }
+  close(Fd);
+
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    perror("fi-campaign: fork");
+    unlink(Template);
+    return false;
+  }
+  if (Pid == 0) {
+    int In = open(Opts.StdinPath.empty() ? "/dev/null" : Opts.StdinPath.c_str(), O_RDONLY);
+    int Null = open("/dev/null", O_WRONLY);
+    if (In < 0 || Null < 0)
+      _exit(127);
+    dup2(In, STDIN_FILENO);
+    dup2(Null, STDOUT_FILENO);
+    if (!Opts.ShowStderr)
+      dup2(Null, STDERR_FILENO);
+    unsetenv("FI_FORKSERVER");
+    unsetenv("FI_INJECT_SITE");
+    setenv("FI_PROFILE_OUT", Template, 1);
+    execv(Opts.TargetArgv[0], Opts.TargetArgv.data());
+    _exit(127);
+  }
+
+  int Status = 0;
+  while (waitpid(Pid, &Status, 0) < 0 && errno == EINTR) {}
+
+  std::ifstream In(Template);
+  std::vector<uint64_t> Counts;
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    char *End = nullptr;
+    unsigned long ID = strtoul(Line.c_str(), &End, 10);
+    uint64_t Count = strtoull(End, nullptr, 10);
+    if (ID >= Counts.size())
+      Counts.resize(ID + 1, 0);
+    Counts[ID] = Count;
+  }
+  unlink(Template);
+
+  uint64_t Total = 0;
+  for (SiteInfo &S : Sites) {
+    S.Count = S.ID < Counts.size() ? Counts[S.ID] : 0;
+    Total += S.Count;
+  }
+  if (!Total) {
+    fprintf(stderr, "fi-campaign: profiling run executed no sites (exit status %d)\n",
+            Status);
+    return false;
+  }
+  return true;
+}
+
+// Two-sided normal quantile for confidence level C, by bisection on erfc
+double normalQuantile(double C) {
+  double Lo = 0, Hi = 10;
+  for (int I = 0; I < 100; ++I) {
+    double Mid = (Lo + Hi) / 2;
+    if (std::erfc(Mid / std::sqrt(2.0)) > 1 - C)
+      Lo = Mid;
+    else
+      Hi = Mid;
+  }
+  return (Lo + Hi) / 2;
+}
+
+// Wilson score interval for K successes in N trials
+void wilsonInterval(unsigned K, unsigned N, double Z, double &Lo, double &Hi) {
+  if (!N) {
+    Lo = 0;
+    Hi = 1;
+    return;
+  }
+  double P = (double)K / N;
+  double Z2 = Z * Z;
+  double Denom = 1 + Z2 / N;
+  double Center = (P + Z2 / (2.0 * N)) / Denom;
+  double Half = Z / Denom * std::sqrt(P * (1 - P) / N + Z2 / (4.0 * N * N));
+  Lo = std::max(0.0, Center - Half);
+  Hi = std::min(1.0, Center + Half);
+}
+
+// CPUs this process may run on, in order
+std::vector<int> allowedCpus() {
+  std::vector<int> Cpus;
+  cpu_set_t Set;
+  if (sched_getaffinity(0, sizeof(Set), &Set) == 0)
+    for (int C = 0; C < CPU_SETSIZE; ++C)
+      if (CPU_ISSET(C, &Set))
+        Cpus.push_back(C);
+  return Cpus;
+}
+
+// Shared between campaign workers
+struct CampaignState {
+  const CampaignOptions &Opts;
+  const std::vector<SiteInfo> &Sites;
+  fi_trial_result_t Golden;
+  OutputDigest GoldenOutput;
+  unsigned Trials = 0;
+  unsigned TimeoutMs = 0;
+  double Z = 0;  // Normal quantile for Opts.Confidence
+  std::atomic<unsigned> NextTrial{0};
+  std::atomic<bool> Failed{false};
+  std::atomic<bool> Converged{false};
+  std::mutex Lock;  // Guards verbose output and Results
+  FIResultsWriter Results;
+  bool WriteResults = false;
+  std::atomic<unsigned> Counts[NUM_OUTCOMES] = {};
+  std::atomic<unsigned> EarlyStops{0};  // Trials stopped on output divergence
+  // Prefix sums of Sites[i].Count for --profile sampling
+  std::vector<uint64_t> CumulativeCounts;
+  // --self-test: outcome per site (trial T runs Sites[T]), and the sites
+  // with no shadow left to corrupt
+  std::vector<uint8_t> SiteOutcomes;
+  std::vector<SiteInfo> OptimizedAway;
+
+  CampaignState(const CampaignOptions &Opts, const std::vector<SiteInfo> &Sites)
+      : Opts(Opts), Sites(Sites) {
+    Z = normalQuantile(Opts.Confidence);
+    if (Opts.Profile) {
+      uint64_t Sum = 0;
+      for (const SiteInfo &S : Sites)
+        CumulativeCounts.push_back(Sum += S.Count);
+    }
+  }
+
+  unsigned injected() const {
+    unsigned N = 0;
+    for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O)
+      N += Counts[O];
+    return N;
+  }
+
+  // True once every outcome rate's interval half-width is within the margin
+  bool marginReached() const {
+    unsigned N = injected();
+    if (!N)
+      return false;
+    for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O) {
+      double Lo, Hi;
+      wilsonInterval(Counts[O], N, Z, Lo, Hi);
+      if ((Hi - Lo) / 2 > Opts.Margin)
+        return false;
+    }
+    return true;
+  }
+
+  // Model for a trial at S: the classic one, or a draw from --models
+  uint32_t pickModel(const SiteInfo &S, uint64_t &Rng) const {
+    if (Opts.Models.empty())
+      return modelForKind(S.Kind);
+    uint32_t Applicable[8];
+    unsigned N = 0;
+    for (uint32_t M : Opts.Models)
+      if (modelAppliesTo(M, S.Kind) && N < 8)
+        Applicable[N++] = M;
+    return N ? Applicable[splitMix64(Rng) % N] : FI_FAULT_NONE;
+  }
+
+  // Fills in the model-specific parts of a request at S
+  void setModel(fi_trial_request_t &Request, const SiteInfo &S, uint64_t &Rng) const {
+    Request.inject.model = pickModel(S, Rng);
+    if (Request.inject.model == FI_FAULT_BYTE_BURST)
+      Request.inject.pattern = 1 + splitMix64(Rng) % 0xFF;
+  }
+
+  // Trial T's request depends only on the seed and T
+  fi_trial_request_t makeRequest(unsigned T) const {
+    fi_trial_request_t Request = {};
+    if (Opts.SelfTest) {
+      Request.inject.site = Sites[T].ID;
+      Request.inject.model = modelForKind(Sites[T].Kind);
+      Request.inject.instance = 1;
+      Request.inject.pattern = Opts.Pattern;
+      return Request;
+    }
+    if (Opts.Site >= 0) {
+      Request.inject.site = (uint32_t)Opts.Site;
+      Request.inject.instance = Opts.Instance;
+      Request.inject.bit = Opts.Bit;
+      Request.inject.model = Opts.Models.empty() ? FI_FAULT_BITFLIP : Opts.Models[0];
+      for (const SiteInfo &S : Sites)
+        if (S.ID == Request.inject.site && Opts.Models.empty())
+          Request.inject.model = modelForKind(S.Kind);
+      return Request;
+    }
+    uint64_t Rng = ((uint64_t)Opts.Seed << 32) ^ T;
+    if (!CumulativeCounts.empty()) {
+      // Uniform over all dynamic site executions of the profiling run
+      uint64_t Pick = splitMix64(Rng) % CumulativeCounts.back();
+      size_t Index = std::upper_bound(CumulativeCounts.begin(),
+                                      CumulativeCounts.end(), Pick) -
+                     CumulativeCounts.begin();
+      const SiteInfo &S = Sites[Index];
+      uint64_t First = Index ? CumulativeCounts[Index - 1] : 0;
+      Request.inject.site = S.ID;
+      Request.inject.instance = 1 + (Pick - First);
+      Request.inject.bit = S.Width ? (uint32_t)(splitMix64(Rng) % S.Width) : 0;
+      setModel(Request, S, Rng);
+      return Request;
+    }
+    const SiteInfo &S = Sites[splitMix64(Rng) % Sites.size()];
+    Request.inject.site = S.ID;
+    Request.inject.instance = 1 + splitMix64(Rng) % (Opts.MaxInstance ? Opts.MaxInstance : 1);
+    Request.inject.bit = S.Width ? (uint32_t)(splitMix64(Rng) % S.Width) : 0;
+    setModel(Request, S, Rng);
+    return Request;
+  }
+};
+
+// --self-test summary: fired checks are expected, everything else is listed
+int printSelfTestReport(const CampaignState &State) {
+  const std::vector<SiteInfo> &Sites = State.Sites;
+  unsigned Fired = 0, Silent = 0, Unreached = 0, Leaked = 0;
+  for (uint8_t O : State.SiteOutcomes) {
+    if (O == OUTCOME_DETECTED)
+      Fired++;
+    else if (O == OUTCOME_MASKED)
+      Silent++;
+    else if (O == OUTCOME_NOT_INJECTED)
+      Unreached++;
+    else
+      Leaked++;
+  }
+
+  printf("\n========================================\n");
+  printf("FI Self-Test Results\n");
+  printf("========================================\n");
+  printf("Shadow sites:            %zu\n", Sites.size() + State.OptimizedAway.size());
+  printf("  Check fired:           %u\n", Fired);
+  printf("  Check silent:          %u\n", Silent);
+  printf("  Not reached:           %u\n", Unreached);
+  printf("  Leaked into program:   %u\n", Leaked);
+  printf("  Optimized away:        %zu\n", State.OptimizedAway.size());
+  unsigned Reached = Fired + Silent + Leaked;
+  printf("Detection coverage:      %.2f%% of reached sites\n",
+         Reached ? 100.0 * Fired / Reached : 0.0);
+
+  for (size_t I = 0; I < Sites.size(); ++I) {
+    uint8_t O = State.SiteOutcomes[I];
+    if (O == OUTCOME_DETECTED && !State.Opts.Verbose)
+      continue;
+    const char *Status = O == OUTCOME_DETECTED     ? "fired"
+                         : O == OUTCOME_MASKED      ? "SILENT"
+                         : O == OUTCOME_NOT_INJECTED ? "not reached"
+                                                     : outcomeName(O);
+    printf("  site %-6u %-12s %-14s %-24s %s\n", Sites[I].ID, Status,
+           Sites[I].Opcode.c_str(), Sites[I].Function.c_str(),
+           Sites[I].Location.c_str());
+  }
+  for (const SiteInfo &S : State.OptimizedAway)
+    printf("  site %-6u %-12s %-14s %-24s %s\n", S.ID, "optimized", S.Opcode.c_str(),
+           S.Function.c_str(), S.Location.c_str());
+  printf("========================================\n");
+  return Silent || Leaked || !State.OptimizedAway.empty() ? 1 : 0;
+}
+
+void runWorker(CampaignState &State, ForkServer &Server, int Cpu) {
+  if (Cpu >= 0) {
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    CPU_SET(Cpu, &Set);
+    pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+  }
+
+  OutputDigest Output;
+  for (;;) {
+    if (State.Failed || State.Converged)
+      break;
+    unsigned T = State.NextTrial.fetch_add(1);
+    if (T >= State.Trials)
+      break;
+
+    fi_trial_request_t Request = State.makeRequest(T);
+    Request.flags = FI_TRIAL_CHECK_TRACE;
+    fi_trial_result_t Result;
+    bool TimedOut = false;
+    if (!Server.runTrial(Request, Result, Output, State.TimeoutMs, TimedOut)) {
+      fprintf(stderr, "fi-campaign: fork server died during trial %u\n", T);
+      State.Failed = true;
+      break;
+    }
+    int O = classify(Result, TimedOut, Output, State.Golden, State.GoldenOutput);
+    State.Counts[O]++;
+    if (State.Opts.SelfTest)
+      State.SiteOutcomes[T] = (uint8_t)O;
+    if (Result.diverged)
+      State.EarlyStops++;
+    if (State.Opts.Margin > 0 && O != OUTCOME_NOT_INJECTED &&
+        State.marginReached())
+      State.Converged = true;
+
+    if (State.WriteResults) {
+      FITrialRecord Record;
+      Record.Site = Request.inject.site;
+      Record.Model = (uint8_t)Request.inject.model;
+      Record.Bit = (uint8_t)Request.inject.bit;
+      Record.Outcome = (uint8_t)O;
+      Record.Latency = O == OUTCOME_DETECTED ? Result.latency : 0;
+      std::string Detection;
+      if (O == OUTCOME_DETECTED)
+        Detection.assign(Result.detection, strnlen(Result.detection, sizeof(Result.detection)));
+      std::lock_guard<std::mutex> Guard(State.Lock);
+      State.Results.add(Record, Detection);
+    }
+
+    if (State.Opts.Verbose) {
+      std::lock_guard<std::mutex> Guard(State.Lock);
+      printf("trial %u: site %u instance %llu %s bit %u -> %s\n", T,
+             Request.inject.site, (unsigned long long)Request.inject.instance,
+             modelName(Request.inject.model), Request.inject.bit, outcomeName(O));
+    }
+  }
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  CampaignOptions Opts;
+  if (!parseOptions(argc, argv, Opts)) {
+    printUsage();
+    return 2;
+  }
+
+  std::vector<SiteInfo> Sites;
+  if (!Opts.SiteMapPath.empty() && !loadSiteMap(Opts.SiteMapPath, Sites))
+    return 2;
+  if (!Opts.Models.empty() && !Opts.SelfTest) {
+    // Sites no selected model applies to would only waste trials
+    Sites.erase(std::remove_if(Sites.begin(), Sites.end(),
+                               [&](const SiteInfo &S) {
+                                 for (uint32_t M : Opts.Models)
+                                   if (modelAppliesTo(M, S.Kind))
+                                     return false;
+                                 return true;
+                               }),
+                Sites.end());
+  }
+  if (Opts.TopUncertain && !Opts.SelfTest && !selectUncertainSites(Opts, Sites))
+    return 2;
+  // Self-test sites whose shadow the optimizer removed cannot be armed
+  std::vector<SiteInfo> OptimizedAway;
+  if (Opts.SelfTest) {
+    auto Gone = std::stable_partition(Sites.begin(), Sites.end(), [](const SiteInfo &S) {
+      return S.Kind != "shadow-optimized";
+    });
+    OptimizedAway.assign(Gone, Sites.end());
+    Sites.erase(Gone, Sites.end());
+  }
+  if (Opts.Site < 0 && Sites.empty() && OptimizedAway.empty()) {
+    fprintf(stderr, "fi-campaign: no sites to inject (need --site-map or --site)\n");
+    return 2;
+  }
+
+  if (Opts.Profile && Opts.Site < 0 && !Opts.SelfTest && !runProfile(Opts, Sites))
+    return 1;
+
+  CampaignState State(Opts, Sites);
+  State.OptimizedAway = std::move(OptimizedAway);
+  if (!Opts.ResultsPath.empty()) {
+    if (!State.Results.open(Opts.ResultsPath)) {
+      fprintf(stderr, "fi-campaign: cannot open results store '%s': %s\n",
+              Opts.ResultsPath.c_str(), strerror(errno));
+      return 1;
+    }
+    State.WriteResults = true;
+  }
+  State.Trials = Opts.Site >= 0 ? 1 : Opts.Trials;
+  if (Opts.SelfTest) {
+    State.Trials = (unsigned)Sites.size();
+    State.SiteOutcomes.assign(Sites.size(), OUTCOME_NOT_INJECTED);
+  }
+
+  std::vector<int> Cpus = allowedCpus();
+  unsigned Jobs = Opts.Jobs ? Opts.Jobs : (unsigned)std::max<size_t>(Cpus.size(), 1);
+  Jobs = std::min(Jobs, std::max(State.Trials, 1u));
+
+  // Start every server before any worker thread exists (fork + threads)
+  std::vector<std::unique_ptr<ForkServer>> Servers;
+  std::vector<int> WorkerCpus;
+  for (unsigned W = 0; W < Jobs; ++W) {
+    int Cpu = Opts.Pin && !Cpus.empty() ? Cpus[W % Cpus.size()] : -1;
+    Servers.emplace_back(new ForkServer());
+    if (!Servers.back()->start(Opts.TargetArgv, Opts.StdinPath, Opts.ShowStderr, Cpu))
+      return 1;
+    WorkerCpus.push_back(Cpu);
+  }
+
+  // Golden run: same snapshot, no fault. Every server records its own
+  // output trace for the trials it will run.
+  fi_trial_request_t GoldenRequest = {};
+  GoldenRequest.inject.site = FI_INJECT_NO_SITE;
+  GoldenRequest.flags = FI_TRIAL_RECORD_TRACE;
+  bool GoldenTimedOut = false;
+  auto GoldenStart = std::chrono::steady_clock::now();
+  if (!Servers[0]->runTrial(GoldenRequest, State.Golden, State.GoldenOutput, 0,
+                            GoldenTimedOut)) {
+    fprintf(stderr, "fi-campaign: golden run failed\n");
+    return 1;
+  }
+  double GoldenMs = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - GoldenStart).count();
+  if (!WIFEXITED(State.Golden.status))
+    fprintf(stderr, "fi-campaign: warning: golden run terminated by signal %d\n",
+            WTERMSIG(State.Golden.status));
+
+  for (unsigned W = 1; W < Jobs; ++W) {
+    fi_trial_result_t Golden;
+    OutputDigest GoldenOutput;
+    if (!Servers[W]->runTrial(GoldenRequest, Golden, GoldenOutput, 0,
+                              GoldenTimedOut)) {
+      fprintf(stderr, "fi-campaign: golden run failed\n");
+      return 1;
+    }
+    if (Golden.status != State.Golden.status || GoldenOutput != State.GoldenOutput)
+      fprintf(stderr, "fi-campaign: warning: golden runs differ; "
+                      "the program is not deterministic\n");
+  }
+
+  State.TimeoutMs = Opts.TimeoutMs ? Opts.TimeoutMs
+                                   : std::max(100u, (unsigned)(GoldenMs * 10));
+
+  auto Start = std::chrono::steady_clock::now();
+  std::vector<std::thread> Workers;
+  for (unsigned W = 0; W < Jobs; ++W)
+    Workers.emplace_back(runWorker, std::ref(State), std::ref(*Servers[W]),
+                         WorkerCpus[W]);
+  for (std::thread &Worker : Workers)
+    Worker.join();
+  double Seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - Start).count();
+
+  State.Results.close();
+  if (State.Failed)
+    return 1;
+
+  if (Opts.SelfTest)
+    return printSelfTestReport(State);
+
+  unsigned Injected = State.injected();
+  unsigned Trials = Injected + State.Counts[OUTCOME_NOT_INJECTED];
+  printf("\n========================================\n");
+  printf("FI Campaign Results\n");
+  printf("========================================\n");
+  printf("Trials:                  %u (%.1f trials/s, %u workers)\n", Trials,
+         Seconds > 0 ? Trials / Seconds : 0.0, Jobs);
+  printf("Trial timeout:           %u ms\n", State.TimeoutMs);
+  if (Opts.Profile)
+    printf("Sampling:                weighted by dynamic execution count\n");
+  if (Opts.Margin > 0)
+    printf("Target margin:           +/-%.2f%% (%s)\n", 100 * Opts.Margin,
+           State.Converged ? "reached" : "not reached, trial cap hit");
+  printf("Faults injected:         %u\n", Injected);
+  printf("Stopped on divergence:   %u\n", (unsigned)State.EarlyStops);
+  printf("  %-22s %8s %9s   %.0f%% Wilson CI\n", "outcome", "count", "rate",
+         100 * Opts.Confidence);
+  for (int O = OUTCOME_MASKED; O < NUM_OUTCOMES; ++O) {
+    double Lo, Hi;
+    wilsonInterval(State.Counts[O], Injected, State.Z, Lo, Hi);
+    unsigned Count = State.Counts[O];
+    printf("  %-22s %8u %8.2f%%   [%6.2f%%, %6.2f%%]\n", outcomeName(O), Count,
+           Injected ? 100.0 * Count / Injected : 0.0, 100 * Lo, 100 * Hi);
+  }
+  printf("Not injected:            %u\n", (unsigned)State.Counts[OUTCOME_NOT_INJECTED]);
+  if (State.WriteResults)
+    printf("Results appended to:     %s\n", Opts.ResultsPath.c_str());
+  printf("========================================\n");
+  return 0;
+}
@@ -1,3 +1,21 @@
+// FIHardeningPass.cpp
+// Static fault injection vulnerability analysis (fi-harden)
+//
+// Scores every injectable instruction (integer/pointer results, stores and
+// conditional branches) by its fault impact, taken from the cached
+// FIVulnerabilityAnalysis (see FIVulnerabilityAnalysis.h).
+//
+// Each function is scanned once: per-block facts (equality compare, call)
+// go into bitsets and per-block counters, which are aggregated per function
+// before anything is printed. Console output goes through a buffered stream.
+//
+// With -fi-harden-report the findings are written as JSON or SARIF with
+// debug-info source locations; otherwise the per-instruction warnings of
+// the block-level heuristics are printed as before. fi-scan (FIScanDriver.cpp)
+// runs the same pass over many modules and merges their reports.
+
+#include "FIHardeningPass.h"
+#include "FIVulnerabilityAnalysis.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
@@ -5,84 +23,368 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/IR/InstIterator.h"
+#include <cmath>
+#include <unistd.h>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 
+static cl::opt<std::string> ReportPath(
+    "fi-harden-report",
+    cl::desc("Write scored findings to this file instead of printing warnings"),
+    cl::init(""));
+
+static cl::opt<std::string> ReportFormat(
+    "fi-harden-report-format",
+    cl::desc("Report format: json or sarif"),
+    cl::init("json"));
+
+static cl::opt<unsigned> ReportMinScore(
+    "fi-harden-report-min-score",
+    cl::desc("Only report instructions scoring at least this much (1-7)"),
+    cl::init(1));
+
 namespace {
 
-class FIHardeningPass : public PassInfoMixin<FIHardeningPass> {
-public:
-  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
-    for (Function &F : M) {
-      if (F.isDeclaration())
-        continue;
-
-      unsigned VulnerableCount = 0;
-      
-      for (BasicBlock &BB : F) {
-        bool hasEqualityComparison = false;
-        bool hasFunctionCall = false;
-        
-        // First pass: detect if BB has equality comparison or function call
-        for (Instruction &I : BB) {
-          if (auto *Cmp = dyn_cast<ICmpInst>(&I)) {
-            if (Cmp->isEquality()) {
-              hasEqualityComparison = true;
-            }
-          }
-          if (isa<CallInst>(&I) || isa<InvokeInst>(&I)) {
-            hasFunctionCall = true;
-          }
-        }
-        
-        // Second pass: check for vulnerabilities
-        for (Instruction &I : BB) {
-          // Check conditional branches
-          if (auto *Br = dyn_cast<BranchInst>(&I)) {
-            if (Br->isConditional() && !hasEqualityComparison) {
-              errs() << "Warning: Conditional branch in function '" << F.getName()
-                     << "' lacks redundant condition check (no equality comparison in BB)\n";
-              VulnerableCount++;
-            }
-          }
-          
-          // Check load/store instructions
-          if (isa<LoadInst>(&I) || isa<StoreInst>(&I)) {
-            if (!hasFunctionCall) {
-              errs() << "Warning: " 
-                     << (isa<LoadInst>(&I) ? "Load" : "Store")
-                     << " instruction in function '" << F.getName()
-                     << "' lacks verification call in BB\n";
-              VulnerableCount++;
+const char *impactRule(uint8_t Impact) {
+  if (Impact & FI_IMPACT_BRANCH)
+    return "fi-reaches-branch";
+  if (Impact & FI_IMPACT_ESCAPED_STORE)
+    return "fi-reaches-escaped-store";
+  return "fi-reaches-return";
+}
+
+std::string impactText(uint8_t Impact) {
+  std::string Text;
+  for (auto [Bit, Name] : {std::pair<uint8_t, const char *>{FI_IMPACT_BRANCH, "a branch"},
+                           {FI_IMPACT_ESCAPED_STORE, "a store to escaped memory"},
+                           {FI_IMPACT_RETURN, "a return value"}}) {
+    if (!(Impact & Bit))
+      continue;
+    if (!Text.empty())
+      Text += ", ";
+    Text += Name;
+  }
+  return Text;
+}
+
+bool isInjectable(const Instruction &I) {
+  if (auto *Br = dyn_cast<BranchInst>(&I))
+    return Br->isConditional();
+  if (isa<StoreInst>(&I))
+    return true;
+  Type *Ty = I.getType();
+  return (Ty->isIntegerTy() || Ty->isPointerTy()) && !isa<AllocaInst>(&I) &&
+         !isa<PHINode>(&I);
+}
+
+// Copies everything the reports need out of the IR
+FIFinding makeFinding(const Instruction &I, uint8_t Impact, float SDC) {
+  FIFinding Fd;
+  Fd.Function = I.getFunction()->getName().str();
+  Fd.Opcode = I.getOpcodeName();
+  Fd.Impact = Impact;
+  Fd.SDC = SDC;
+  if (const DILocation *Loc = I.getDebugLoc().get()) {
+    StringRef Name = Loc->getFilename(), Dir = Loc->getDirectory();
+    Fd.File = Dir.empty() || Name.starts_with("/") ? Name.str() : (Dir + "/" + Name).str();
+    Fd.Line = Loc->getLine();
+    Fd.Column = Loc->getColumn();
+  }
+  return Fd;
+}
+
+void writeJSONReport(raw_ostream &OS, ArrayRef<FIModuleReport> Reports) {
+  json::OStream J(OS, 2);
+  J.object([&] {
+    J.attributeArray("modules", [&] {
+      for (const FIModuleReport &R : Reports)
+        J.value(R.Module);
+    });
+    J.attributeArray("findings", [&] {
+      for (const FIModuleReport &R : Reports)
+        for (const FIFinding &Fd : R.Findings)
+          J.object([&] {
+            J.attribute("module", R.Module);
+            J.attribute("function", Fd.Function);
+            J.attribute("opcode", Fd.Opcode);
+            J.attribute("score", (int64_t)Fd.Impact);
+            J.attribute("reaches_branch", (Fd.Impact & FI_IMPACT_BRANCH) != 0);
+            J.attribute("reaches_escaped_store", (Fd.Impact & FI_IMPACT_ESCAPED_STORE) != 0);
+            J.attribute("reaches_return", (Fd.Impact & FI_IMPACT_RETURN) != 0);
+            J.attribute("sdc_propensity", std::round(Fd.SDC * 1e4) / 1e4);
+            if (!Fd.File.empty()) {
+              J.attribute("file", Fd.File);
+              J.attribute("line", (int64_t)Fd.Line);
+              J.attribute("column", (int64_t)Fd.Column);
             }
-          }
+          });
+    });
+  });
+  OS << "\n";
+}
+
+void writeSARIFReport(raw_ostream &OS, ArrayRef<FIModuleReport> Reports) {
+  static const char *Rules[][2] = {
+      {"fi-reaches-branch", "A fault in this instruction can change control flow"},
+      {"fi-reaches-escaped-store", "A fault in this instruction can corrupt memory visible outside the function"},
+      {"fi-reaches-return", "A fault in this instruction can corrupt the return value"}};
+
+  json::OStream J(OS, 2);
+  J.object([&] {
+    J.attribute("$schema", "https://json.schemastore.org/sarif-2.1.0.json");
+    J.attribute("version", "2.1.0");
+    J.attributeArray("runs", [&] {
+      J.object([&] {
+        J.attributeObject("tool", [&] {
+          J.attributeObject("driver", [&] {
+            J.attribute("name", "FIHardeningPass");
+            J.attributeArray("rules", [&] {
+              for (auto &Rule : Rules)
+                J.object([&] {
+                  J.attribute("id", Rule[0]);
+                  J.attributeObject("shortDescription",
+                                    [&] { J.attribute("text", Rule[1]); });
+                });
+            });
+          });
+        });
+        J.attributeArray("results", [&] {
+          for (const FIModuleReport &R : Reports)
+            for (const FIFinding &Fd : R.Findings)
+              J.object([&] {
+                J.attribute("ruleId", impactRule(Fd.Impact));
+                J.attribute("level", Fd.Impact & FI_IMPACT_BRANCH ? "error"
+                                     : Fd.Impact & FI_IMPACT_ESCAPED_STORE ? "warning"
+                                                                        : "note");
+                J.attributeObject("message", [&] {
+                  J.attribute("text", ("Fault in '" + Twine(Fd.Opcode) +
+                                       "' in function '" + Fd.Function +
+                                       "' reaches " + impactText(Fd.Impact))
+                                          .str());
+                });
+                J.attributeArray("locations", [&] {
+                  J.object([&] {
+                    if (!Fd.File.empty())
+                      J.attributeObject("physicalLocation", [&] {
+                        J.attributeObject("artifactLocation",
+                                          [&] { J.attribute("uri", Fd.File); });
+                        J.attributeObject("region", [&] {
+                          J.attribute("startLine", (int64_t)Fd.Line);
+                          if (Fd.Column)
+                            J.attribute("startColumn", (int64_t)Fd.Column);
+                        });
+                      });
+                    J.attributeArray("logicalLocations", [&] {
+                      J.object([&] {
+                        J.attribute("name", Fd.Function);
+                        J.attribute("kind", "function");
+                      });
+                    });
+                  });
+                });
+                J.attributeObject("properties", [&] {
+                  J.attribute("module", R.Module);
+                  J.attribute("score", (int64_t)Fd.Impact);
+                  J.attribute("sdcPropensity", std::round(Fd.SDC * 1e4) / 1e4);
+                });
+              });
+        });
+      });
+    });
+  });
+  OS << "\n";
+}
+
+// Per-function aggregate of the block-level heuristics and the scores
+struct FunctionSummary {
+  unsigned UncheckedBranches = 0;  // Conditional branch, no equality compare in BB
+  unsigned UnverifiedLoads = 0;    // Load, no call in BB
+  unsigned UnverifiedStores = 0;   // Store, no call in BB
+  unsigned Scored = 0;
+  unsigned MaxScore = 0;
+
+  unsigned vulnerable() const {
+    return UncheckedBranches + UnverifiedLoads + UnverifiedStores;
+  }
+};
+
+// Facts gathered in the single scan, one bit or counter per basic block.
+// Kept across functions so that steady-state scanning does not allocate.
+struct BlockFacts {
+  BitVector HasEqualityCompare;
+  BitVector HasCall;
+  SmallVector<unsigned, 0> CondBranches, Loads, Stores;
+
+  void reset(unsigned NumBlocks) {
+    HasEqualityCompare.reset();
+    HasEqualityCompare.resize(NumBlocks);
+    HasCall.reset();
+    HasCall.resize(NumBlocks);
+    CondBranches.assign(NumBlocks, 0);
+    Loads.assign(NumBlocks, 0);
+    Stores.assign(NumBlocks, 0);
+  }
+};
+
+class FunctionScanner {
+  BlockFacts Facts;
+
+public:
+  // One walk over F: block facts, and with Impacts the scored findings
+  FunctionSummary scan(Function &F, const FIVulnerabilityInfo *Impacts,
+                       std::vector<FIFinding> &Findings) {
+    FunctionSummary Summary;
+    Facts.reset(F.size());
+    unsigned B = 0;
+    for (BasicBlock &BB : F) {
+      for (Instruction &I : BB) {
+        if (auto *Cmp = dyn_cast<ICmpInst>(&I)) {
+          if (Cmp->isEquality())
+            Facts.HasEqualityCompare.set(B);
+        } else if (isa<CallInst>(&I) || isa<InvokeInst>(&I)) {
+          Facts.HasCall.set(B);
+        } else if (auto *Br = dyn_cast<BranchInst>(&I)) {
+          Facts.CondBranches[B] += Br->isConditional();
+        } else if (isa<LoadInst>(&I)) {
+          Facts.Loads[B]++;
+        } else if (isa<StoreInst>(&I)) {
+          Facts.Stores[B]++;
         }
+
+        if (!Impacts || !isInjectable(I))
+          continue;
+        uint8_t Impact = Impacts->impact(&I);
+        if (!Impact || Impact < ReportMinScore)
+          continue;
+        Findings.push_back(makeFinding(I, Impact, Impacts->sdcPropensity(&I)));
+        Summary.Scored++;
+        Summary.MaxScore = std::max(Summary.MaxScore, (unsigned)Impact);
       }
-      
-      if (VulnerableCount > 0) {
-        errs() << "Function '" << F.getName() 
-               << "' has " << VulnerableCount 
-               << " potentially vulnerable instruction(s)\n";
+      ++B;
+    }
+
+    // Aggregate over the bitsets; no instruction is visited twice
+    for (unsigned Block = 0; Block < B; ++Block) {
+      if (!Facts.HasEqualityCompare.test(Block))
+        Summary.UncheckedBranches += Facts.CondBranches[Block];
+      if (!Facts.HasCall.test(Block)) {
+        Summary.UnverifiedLoads += Facts.Loads[Block];
+        Summary.UnverifiedStores += Facts.Stores[Block];
       }
     }
-    
-    // This pass does not modify the IR
-    return PreservedAnalyses::all();
+    return Summary;
   }
-  
-  static bool isRequired() { return true; }
 };
 
+// The legacy warning lines, one per vulnerable instruction
+void printWarnings(raw_ostream &OS, StringRef Name, const FunctionSummary &Summary) {
+  for (unsigned I = 0; I < Summary.UncheckedBranches; ++I)
+    OS << "Warning: Conditional branch in function '" << Name
+       << "' lacks redundant condition check (no equality comparison in BB)\n";
+  for (unsigned I = 0; I < Summary.UnverifiedLoads; ++I)
+    OS << "Warning: Load instruction in function '" << Name
+       << "' lacks verification call in BB\n";
+  for (unsigned I = 0; I < Summary.UnverifiedStores; ++I)
+    OS << "Warning: Store instruction in function '" << Name
+       << "' lacks verification call in BB\n";
+}
+
 } // anonymous namespace
 
+bool checkFIReportOptions() {
+  if (ReportFormat == "json" || ReportFormat == "sarif")
+    return true;
+  errs() << "fi-harden: unknown report format '" << ReportFormat << "'\n";
+  return false;
+}
+
+bool writeFIReport(ArrayRef<FIModuleReport> Reports) {
+  if (ReportPath.empty())
+    return true;
+  std::error_code EC;
+  raw_fd_ostream OS(ReportPath, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "fi-harden: cannot write report '" << ReportPath
+           << "': " << EC.message() << "\n";
+    return false;
+  }
+  if (ReportFormat == "sarif")
+    writeSARIFReport(OS, Reports);
+  else
+    writeJSONReport(OS, Reports);
+  return true;
+}
+
+PreservedAnalyses FIHardeningPass::run(Module &M, ModuleAnalysisManager &MAM) {
+  bool Report = Collect || !ReportPath.empty();
+  if (!Collect && Report && !checkFIReportOptions())
+    return PreservedAnalyses::all();
+
+  FIModuleReport Local;
+  FIModuleReport &Result = Collect ? *Collect : Local;
+  Result.Module = M.getModuleIdentifier();
+
+  // Buffered stderr: console output is written in large chunks instead of
+  // one unbuffered write per fragment
+  raw_fd_ostream Out(STDERR_FILENO, /*shouldClose=*/false);
+
+  FunctionAnalysisManager &FAM =
+      MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  FunctionScanner Scanner;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+
+    const FIVulnerabilityInfo *Impacts =
+        Report ? &FAM.getResult<FIVulnerabilityAnalysis>(F) : nullptr;
+    FunctionSummary Summary = Scanner.scan(F, Impacts, Result.Findings);
+    Result.Functions++;
+    Result.Vulnerable += Summary.vulnerable();
+
+    if (Collect)
+      continue;
+    if (Report) {
+      if (Summary.Scored > 0)
+        Out << "Function '" << F.getName() << "' has " << Summary.Scored
+            << " scored instruction(s), max score " << Summary.MaxScore << "\n";
+      continue;
+    }
+
+    printWarnings(Out, F.getName(), Summary);
+    if (Summary.vulnerable() > 0)
+      Out << "Function '" << F.getName()
+          << "' has " << Summary.vulnerable()
+          << " potentially vulnerable instruction(s)\n";
+  }
+  Out.flush();
+
+  if (!Collect && Report)
+    writeFIReport(Local);
+
+  // This pass does not modify the IR
+  return PreservedAnalyses::all();
+}
+
 // Pass registration
 extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
 llvmGetPassPluginInfo() {
   return {
     LLVM_PLUGIN_API_VERSION, "FIHardeningPass", LLVM_VERSION_STRING,
     [](PassBuilder &PB) {
+      PB.registerAnalysisRegistrationCallback(
+        [](FunctionAnalysisManager &FAM) {
+          FAM.registerPass([] { return FIVulnerabilityAnalysis(); });
+        }
+      );
       PB.registerPipelineParsingCallback(
         [](StringRef Name, ModulePassManager &MPM,
            ArrayRef<PassBuilder::PipelineElement>) {
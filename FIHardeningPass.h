@@ -0,0 +1,56 @@
+// FIHardeningPass.h
+// Static fault injection vulnerability analysis (fi-harden)
+//
+// Registered as "fi-harden" by the FIHardeningPass plugin and run directly
+// by the fi-scan driver. Findings are copied out of the IR, so they outlive
+// the module's LLVMContext and reports of many modules can be merged.
+
+#ifndef FI_HARDENING_PASS_H
+#define FI_HARDENING_PASS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/PassManager.h"
+#include <string>
+#include <vector>
+
+// One scored instruction
+struct FIFinding {
+  std::string Function;
+  std::string Opcode;
+  std::string File;        // "dir/file", empty without debug info
+  unsigned Line = 0;
+  unsigned Column = 0;
+  uint8_t Impact = 0;      // FIImpact bits
+  float SDC = 0.0f;        // Estimated SDC propensity
+};
+
+// Everything fi-harden found in one module
+struct FIModuleReport {
+  std::string Module;
+  std::vector<FIFinding> Findings;
+  unsigned Functions = 0;   // Function definitions scanned
+  unsigned Vulnerable = 0;  // Instructions flagged by the block-level heuristics
+};
+
+// False (after printing why) if -fi-harden-report-format is not json/sarif
+bool checkFIReportOptions();
+
+// Writes Reports as one JSON or SARIF document to the -fi-harden-report
+// file. Does nothing if no report was requested; false if it cannot write.
+bool writeFIReport(llvm::ArrayRef<FIModuleReport> Reports);
+
+class FIHardeningPass : public llvm::PassInfoMixin<FIHardeningPass> {
+  FIModuleReport *Collect;
+
+public:
+  // With Collect, the findings are always scored and stored there, and
+  // nothing is printed or written
+  explicit FIHardeningPass(FIModuleReport *Collect = nullptr)
+      : Collect(Collect) {}
+
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+  static bool isRequired() { return true; }
+};
+
+#endif // FI_HARDENING_PASS_H
@@ -1,19 +1,48 @@
 // FIHardeningRuntime.cpp
 // Runtime verification library implementation
+//
+// fi-harden-transform declares these entry points with optimizer attributes
+// (see initializeRuntimeFunctions), so every one of them must stay true to
+// them: nothing unwinds (built with -fno-exceptions), pointer arguments are
+// only read, and all writes go to runtime-private state (statistics,
+// tables, stdio, the detection trace). Only fi_checksum_update keeps its
+// pointer argument. Checks that can fail may abort or exit and so are not
+// willreturn; the failure paths are cold and out of line.
 
 #include "FIHardeningRuntime.h"
+#include "FIInjectionRuntime.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-// Global statistics
-static fi_runtime_stats_t g_stats = {0};
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FI_STORE_LOG_GATHER 1
+#endif
+
+// Global statistics. Private, like all runtime state, so that the transform
+// can declare the checks inaccessiblememonly
+static fi_runtime_stats_t fi_stats = {0};
+
+// Relaxed atomics: the checker thread (-fi-harden-async) counts and
+// reports mismatches while application threads keep counting
+static void fi_stat_add(uint64_t *counter) {
+  __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+// Mismatches folded in by fi_sticky_verify_*, checked by fi_output_commit
+static __thread uint64_t fi_sticky_error = 0;
 
 // Error handling mode
 static fi_error_mode_t g_error_mode = FI_ERROR_ABORT;
 
+// Detection trace (FI_TRACE_OUT), -1 if disabled
+static int g_trace_fd = -1;
+
 // Checksum table for memory regions
 #define MAX_CHECKSUM_ENTRIES 1024
 typedef struct {
@@ -47,17 +76,21 @@ static checksum_entry_t *find_checksum_entry(void *addr, size_t size) {
 
 // Initialization and shutdown
 void fi_runtime_init(void) {
-  memset(&g_stats, 0, sizeof(g_stats));
+  memset(&fi_stats, 0, sizeof(fi_stats));
   g_checksum_count = 0;
   g_error_mode = FI_ERROR_ABORT;
   
+  const char *trace = getenv("FI_TRACE_OUT");
+  if (trace && *trace && g_trace_fd < 0)
+    g_trace_fd = open(trace, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  
   // Optionally register atexit handler
   atexit(fi_runtime_shutdown);
 }
 
 void fi_runtime_shutdown(void) {
   // Print statistics if any verifications were performed
-  if (g_stats.verifications_performed > 0) {
+  if (fi_stats.verifications_performed > 0 || fi_stats.async_verifications > 0) {
     fi_runtime_print_stats();
   }
 }
@@ -67,18 +100,24 @@ void fi_runtime_print_stats(void) {
   fprintf(stderr, "========================================\n");
   fprintf(stderr, "FI Hardening Runtime Statistics\n");
   fprintf(stderr, "========================================\n");
-  fprintf(stderr, "Total verifications:     %lu\n", g_stats.verifications_performed);
-  fprintf(stderr, "Mismatches detected:     %lu\n", g_stats.mismatches_detected);
-  fprintf(stderr, "  Int32 verifications:   %lu\n", g_stats.int32_verifications);
-  fprintf(stderr, "  Int64 verifications:   %lu\n", g_stats.int64_verifications);
-  fprintf(stderr, "  Pointer verifications: %lu\n", g_stats.pointer_verifications);
-  fprintf(stderr, "  Branch verifications:  %lu\n", g_stats.branch_verifications);
-  fprintf(stderr, "  Checksum verifications:%lu\n", g_stats.checksum_verifications);
-  fprintf(stderr, "  Checksum failures:     %lu\n", g_stats.checksum_failures);
-  
-  if (g_stats.verifications_performed > 0) {
-    double mismatch_rate = (double)g_stats.mismatches_detected / 
-                          g_stats.verifications_performed * 100.0;
+  fprintf(stderr, "Total verifications:     %lu\n", fi_stats.verifications_performed);
+  fprintf(stderr, "Mismatches detected:     %lu\n", fi_stats.mismatches_detected);
+  fprintf(stderr, "  Int32 verifications:   %lu\n", fi_stats.int32_verifications);
+  fprintf(stderr, "  Int64 verifications:   %lu\n", fi_stats.int64_verifications);
+  fprintf(stderr, "  Pointer verifications: %lu\n", fi_stats.pointer_verifications);
+  fprintf(stderr, "  Branch verifications:  %lu\n", fi_stats.branch_verifications);
+  fprintf(stderr, "  Checksum verifications:%lu\n", fi_stats.checksum_verifications);
+  fprintf(stderr, "  Checksum failures:     %lu\n", fi_stats.checksum_failures);
+  if (fi_stats.async_verifications > 0)
+    fprintf(stderr, "  Async verifications:   %lu\n", fi_stats.async_verifications);
+  if (fi_stats.commit_verifications > 0)
+    fprintf(stderr, "  Commit verifications:  %lu\n", fi_stats.commit_verifications);
+  if (fi_stats.store_log_verifications > 0)
+    fprintf(stderr, "  Logged stores checked: %lu\n", fi_stats.store_log_verifications);
+  
+  if (fi_stats.verifications_performed > 0) {
+    double mismatch_rate = (double)fi_stats.mismatches_detected / 
+                          fi_stats.verifications_performed * 100.0;
     fprintf(stderr, "Mismatch rate:           %.4f%%\n", mismatch_rate);
   }
   
@@ -87,7 +126,9 @@ void fi_runtime_print_stats(void) {
 }
 
 const fi_runtime_stats_t *fi_get_stats(void) {
-  return &g_stats;
+  static fi_runtime_stats_t snapshot;
+  snapshot = fi_stats;
+  return &snapshot;
 }
 
 void fi_set_error_mode(fi_error_mode_t mode) {
@@ -98,10 +139,30 @@ fi_error_mode_t fi_get_error_mode(void) {
   return g_error_mode;
 }
 
+// Append the binary trace record of a failed check; the location is only
+// scanned for its "#N" check ID, never formatted
+static void trace_mismatch(const char *type, const char *location) {
+  fi_trace_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.magic = FI_TRACE_MAGIC;
+  record.check = FI_TRACE_NO_CHECK;
+  const char *id = location ? strrchr(location, '#') : NULL;
+  if (id && id[1] >= '0' && id[1] <= '9')
+    record.check = (uint32_t)strtoul(id + 1, NULL, 10);
+  record.pid = (uint32_t)getpid();
+  strncpy(record.type, type, sizeof(record.type));
+  record.sequence = fi_stats.verifications_performed;
+  if (write(g_trace_fd, &record, sizeof(record)) != (ssize_t)sizeof(record))
+    g_trace_fd = -1;
+}
+
 // Handle verification failure
+__attribute__((cold))
 static void handle_mismatch(const char *type, const char *location, 
                            const char *details) {
-  g_stats.mismatches_detected++;
+  fi_stat_add(&fi_stats.mismatches_detected);
+  if (g_trace_fd >= 0)
+    trace_mismatch(type, location);
   
   fprintf(stderr, "\n[FI MISMATCH DETECTED]\n");
   fprintf(stderr, "Type:     %s\n", type);
@@ -122,57 +183,131 @@ static void handle_mismatch(const char *type, const char *location,
     case FI_ERROR_CORRECT:
       fprintf(stderr, "Attempting correction (not fully implemented)\n");
       break;
+      
+    case FI_ERROR_EXIT:
+      // Report the detection to the campaign runner without running atexit
+      // handlers or flushing partial program output
+      fi_inject_note_detection(type, location);
+      _exit(FI_DETECTED_EXIT_CODE);
   }
 }
 
-// Verification implementations
+void fi_count_verification(fi_verify_kind_t kind) {
+  switch (kind) {
+  case FI_VERIFY_INT32:
+    fi_stat_add(&fi_stats.verifications_performed);
+    fi_stat_add(&fi_stats.int32_verifications);
+    break;
+  case FI_VERIFY_INT64:
+    fi_stat_add(&fi_stats.verifications_performed);
+    fi_stat_add(&fi_stats.int64_verifications);
+    break;
+  case FI_VERIFY_POINTER:
+    fi_stat_add(&fi_stats.verifications_performed);
+    fi_stat_add(&fi_stats.pointer_verifications);
+    break;
+  case FI_VERIFY_BRANCH:
+    fi_stat_add(&fi_stats.verifications_performed);
+    fi_stat_add(&fi_stats.branch_verifications);
+    break;
+  case FI_VERIFY_ASYNC:
+    fi_stat_add(&fi_stats.async_verifications);
+    break;
+  }
+}
+
+// Verification implementations. The fast paths only call the out-of-line
+// counting and fi_mismatch_* functions, so -fi-harden-inline-runtime can
+// inline them from FIHardeningRuntime.bc without copying private state.
 void fi_verify_int32(int32_t value, int32_t expected, const char *location) {
-  g_stats.verifications_performed++;
-  g_stats.int32_verifications++;
+  fi_count_verification(FI_VERIFY_INT32);
   
-  if (value != expected) {
-    char details[256];
-    snprintf(details, sizeof(details), 
-             "int32 mismatch: got %d, expected %d", value, expected);
-    handle_mismatch("int32", location, details);
-  }
+  if (__builtin_expect(value != expected, 0))
+    fi_mismatch_int32(value, expected, location);
 }
 
 void fi_verify_int64(int64_t value, int64_t expected, const char *location) {
-  g_stats.verifications_performed++;
-  g_stats.int64_verifications++;
+  fi_count_verification(FI_VERIFY_INT64);
   
-  if (value != expected) {
-    char details[256];
-    snprintf(details, sizeof(details), 
-             "int64 mismatch: got %ld, expected %ld", value, expected);
-    handle_mismatch("int64", location, details);
-  }
+  if (__builtin_expect(value != expected, 0))
+    fi_mismatch_int64(value, expected, location);
 }
 
 void fi_verify_pointer(void *ptr, void *expected, const char *location) {
-  g_stats.verifications_performed++;
-  g_stats.pointer_verifications++;
+  fi_count_verification(FI_VERIFY_POINTER);
   
-  if (ptr != expected) {
-    char details[256];
-    snprintf(details, sizeof(details), 
-             "pointer mismatch: got %p, expected %p", ptr, expected);
-    handle_mismatch("pointer", location, details);
-  }
+  if (__builtin_expect(ptr != expected, 0))
+    fi_mismatch_pointer(ptr, expected, location);
 }
 
 void fi_verify_branch(int condition, int expected, const char *location) {
-  g_stats.verifications_performed++;
-  g_stats.branch_verifications++;
+  fi_count_verification(FI_VERIFY_BRANCH);
   
-  if (condition != expected) {
-    char details[256];
-    snprintf(details, sizeof(details), 
-             "branch condition mismatch: got %d, expected %d", 
-             condition, expected);
-    handle_mismatch("branch", location, details);
-  }
+  if (__builtin_expect(condition != expected, 0))
+    fi_mismatch_branch(condition, expected, location);
+}
+
+// Output-commit checking: no branch and no failure path, a mismatch only
+// sets bits in the calling thread's sticky error word. The location is
+// unused: fi_output_commit reports at the commit point, and keeping the
+// first failing one would add a store to every check (and capture an
+// argument the transform declares nocapture)
+void fi_sticky_verify_int32(int32_t value, int32_t expected, const char *location) {
+  (void)location;
+  fi_stats.verifications_performed++;
+  fi_stats.int32_verifications++;
+  fi_sticky_error |= (uint32_t)(value ^ expected);
+}
+
+void fi_sticky_verify_int64(int64_t value, int64_t expected, const char *location) {
+  (void)location;
+  fi_stats.verifications_performed++;
+  fi_stats.int64_verifications++;
+  fi_sticky_error |= (uint64_t)(value ^ expected);
+}
+
+void fi_sticky_verify_pointer(void *ptr, void *expected, const char *location) {
+  (void)location;
+  fi_stats.verifications_performed++;
+  fi_stats.pointer_verifications++;
+  fi_sticky_error |= (uintptr_t)ptr ^ (uintptr_t)expected;
+}
+
+void fi_sticky_verify_branch(int condition, int expected, const char *location) {
+  (void)location;
+  fi_stats.verifications_performed++;
+  fi_stats.branch_verifications++;
+  fi_sticky_error |= (uint32_t)(condition ^ expected);
+}
+
+// Failure paths
+void fi_mismatch_int32(int32_t value, int32_t expected, const char *location) {
+  char details[256];
+  snprintf(details, sizeof(details), 
+           "int32 mismatch: got %d, expected %d", value, expected);
+  handle_mismatch("int32", location, details);
+}
+
+void fi_mismatch_int64(int64_t value, int64_t expected, const char *location) {
+  char details[256];
+  snprintf(details, sizeof(details), 
+           "int64 mismatch: got %ld, expected %ld", value, expected);
+  handle_mismatch("int64", location, details);
+}
+
+void fi_mismatch_pointer(void *ptr, void *expected, const char *location) {
+  char details[256];
+  snprintf(details, sizeof(details), 
+           "pointer mismatch: got %p, expected %p", ptr, expected);
+  handle_mismatch("pointer", location, details);
+}
+
+void fi_mismatch_branch(int condition, int expected, const char *location) {
+  char details[256];
+  snprintf(details, sizeof(details), 
+           "branch condition mismatch: got %d, expected %d", 
+           condition, expected);
+  handle_mismatch("branch", location, details);
 }
 
 void fi_checksum_update(void *addr, size_t size) {
@@ -194,9 +329,127 @@ void fi_checksum_update(void *addr, size_t size) {
   entry->checksum = calculate_checksum(addr, size);
 }
 
+void fi_output_commit(const void *buf, size_t size, const char *location) {
+  fi_stats.verifications_performed++;
+  fi_stats.commit_verifications++;
+  
+  if (__builtin_expect(fi_sticky_error != 0, 0)) {
+    char details[256];
+    snprintf(details, sizeof(details),
+             "sticky error word %016lx set before output", fi_sticky_error);
+    fi_sticky_error = 0;  // Report each corruption once in log mode
+    handle_mismatch("commit", location, details);
+  }
+  
+  // Checksummed regions lying inside the outgoing buffer
+  const char *begin = (const char *)buf, *end = begin + size;
+  for (size_t i = 0; buf && i < g_checksum_count; i++) {
+    checksum_entry_t *entry = &g_checksum_table[i];
+    const char *addr = (const char *)entry->addr;
+    if (addr < begin || addr + entry->size > end)
+      continue;
+    uint32_t current_checksum = calculate_checksum(entry->addr, entry->size);
+    if (current_checksum != entry->checksum) {
+      fi_stats.checksum_failures++;
+      char details[256];
+      snprintf(details, sizeof(details),
+               "output buffer corrupted at %p: checksum %08x, expected %08x",
+               entry->addr, current_checksum, entry->checksum);
+      handle_mismatch("checksum", location, details);
+    }
+  }
+}
+
+// The first size bytes of a location or a logged value (little-endian)
+static inline uint64_t logged_bytes(const void *addr, uint8_t size) {
+  uint64_t value = 0;
+  memcpy(&value, addr, size);
+  return value;
+}
+
+#ifdef FI_STORE_LOG_GATHER
+// All-match pass over four 8-byte entries at a time: one gather of the
+// current memory, compared with the logged values
+__attribute__((target("avx2")))
+static uint64_t store_log_diff_gather(const fi_store_log_t *log, uint32_t count) {
+  __m256i diff = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i addr = _mm256_loadu_si256((const __m256i *)&log->addr[i]);
+    __m256i current = _mm256_i64gather_epi64((const long long *)0, addr, 1);
+    __m256i stored = _mm256_loadu_si256((const __m256i *)&log->value[i]);
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(current, stored));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, diff);
+  uint64_t result = lanes[0] | lanes[1] | lanes[2] | lanes[3];
+  for (; i < count; i++)
+    result |= logged_bytes(log->addr[i], 8) ^ log->value[i];
+  return result;
+}
+#endif
+
+// Nonzero if any logged location no longer holds its logged value. Logs
+// of 8-byte stores are gathered where the CPU can; narrower entries cannot
+// be, since a full word at their address may cross into an unmapped page.
+static uint64_t store_log_diff(const fi_store_log_t *log, uint32_t count) {
+#ifdef FI_STORE_LOG_GATHER
+  static const int have_gather = __builtin_cpu_supports("avx2");
+  uint8_t all_words = count >= 4;
+  for (uint32_t i = 0; i < count; i++)
+    all_words &= log->size[i] == 8;
+  if (all_words && have_gather)
+    return store_log_diff_gather(log, count);
+#endif
+  uint64_t diff = 0;
+  for (uint32_t i = 0; i < count; i++)
+    diff |= logged_bytes(log->addr[i], log->size[i]) ^
+            logged_bytes(&log->value[i], log->size[i]);
+  return diff;
+}
+
+void fi_store_log_flush(fi_store_log_t *log, const char *location) {
+  uint32_t count = log->count;
+  log->count = 0;
+  if (count == 0)
+    return;
+  if (__builtin_expect(count > FI_STORE_LOG_ENTRIES, 0)) {
+    char details[256];
+    snprintf(details, sizeof(details), "store log count corrupted: %u", count);
+    handle_mismatch("store", location, details);
+    count = FI_STORE_LOG_ENTRIES;
+  }
+  fi_stats.verifications_performed += count;
+  fi_stats.store_log_verifications += count;
+  
+  if (__builtin_expect(store_log_diff(log, count) == 0, 1))
+    return;
+  
+  // A location stored twice, or partly overwritten by a wider store, only
+  // has to hold the value of the last entry covering it
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t current = logged_bytes(log->addr[i], log->size[i]);
+    uint64_t stored = logged_bytes(&log->value[i], log->size[i]);
+    if (current == stored)
+      continue;
+    uintptr_t begin = (uintptr_t)log->addr[i], end = begin + log->size[i];
+    int overwritten = 0;
+    for (uint32_t j = i + 1; j < count && !overwritten; j++)
+      overwritten = (uintptr_t)log->addr[j] < end &&
+                    begin < (uintptr_t)log->addr[j] + log->size[j];
+    if (overwritten)
+      continue;
+    char details[256];
+    snprintf(details, sizeof(details),
+             "store to %p lost: memory holds %lx, stored %lx",
+             log->addr[i], current, stored);
+    handle_mismatch("store", location, details);
+  }
+}
+
 int fi_checksum_verify(void *addr, size_t size) {
-  g_stats.verifications_performed++;
-  g_stats.checksum_verifications++;
+  fi_stats.verifications_performed++;
+  fi_stats.checksum_verifications++;
   
   checksum_entry_t *entry = find_checksum_entry(addr, size);
   
@@ -209,7 +462,7 @@ int fi_checksum_verify(void *addr, size_t size) {
   uint32_t current_checksum = calculate_checksum(addr, size);
   
   if (current_checksum != entry->checksum) {
-    g_stats.checksum_failures++;
+    fi_stats.checksum_failures++;
     char details[256];
     snprintf(details, sizeof(details), 
              "memory corruption at %p: checksum %08x, expected %08x",
@@ -225,7 +478,7 @@ int fi_checksum_verify(void *addr, size_t size) {
 
 // Control-Flow Integrity verification
 void fi_verify_cfi(void *target, void *expected, const char *location) {
-  g_stats.verifications_performed++;
+  fi_stats.verifications_performed++;
   
   if (target != expected) {
     char details[256];
@@ -244,13 +497,18 @@ void fi_log_fault(const char *message, int severity) {
   fprintf(stderr, "[FI-Runtime] [%s] %s\n", severity_str[severity], message);
   
   if (severity >= 2) {
-    g_stats.mismatches_detected++;
+    fi_stats.mismatches_detected++;
+    // Error blocks end in unreachable; never fall through them in a trial
+    if (g_error_mode == FI_ERROR_EXIT) {
+      fi_inject_note_detection("fault_log", message);
+      _exit(FI_DETECTED_EXIT_CODE);
+    }
   }
 }
 
 // Memory bounds checking
 int fi_check_bounds(void *ptr, void *base, size_t size) {
-  g_stats.verifications_performed++;
+  fi_stats.verifications_performed++;
   
   uintptr_t ptr_addr = (uintptr_t)ptr;
   uintptr_t base_addr = (uintptr_t)base;
@@ -283,7 +541,7 @@ void fi_protect_return_addr(void **addr_location) {
 }
 
 int fi_verify_return_addr(void **addr_location) {
-  g_stats.verifications_performed++;
+  fi_stats.verifications_performed++;
   
   if (g_return_addr_count == 0) {
     fprintf(stderr, "Warning: No saved return address to verify\n");
@@ -307,7 +565,7 @@ int fi_verify_return_addr(void **addr_location) {
 
 // Hardware I/O validation
 void fi_validate_hardware_io(void *addr, int32_t expected_value) {
-  g_stats.verifications_performed++;
+  fi_stats.verifications_performed++;
   
   // Read actual value from hardware register
   int32_t actual_value = *(volatile int32_t *)addr;
@@ -334,8 +592,9 @@ void fi_add_timing_noise(void) {
   }
 }
 
-// Constructor to initialize runtime (GCC/Clang attribute)
-__attribute__((constructor))
+// Constructor to initialize runtime (GCC/Clang attribute). Runs before the
+// default-priority fault injection fork server so trials start initialized.
+__attribute__((constructor(101)))
 static void fi_runtime_constructor(void) {
   fi_runtime_init();
 }
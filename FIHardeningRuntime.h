@@ -10,6 +10,15 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// Failure handlers: kept out of line and off the hot path
+#if defined(__GNUC__)
+#define FI_COLD __attribute__((cold, noinline))
+#define FI_NOINLINE __attribute__((noinline))
+#else
+#define FI_COLD
+#define FI_NOINLINE
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -20,6 +29,85 @@ void fi_verify_int64(int64_t value, int64_t expected, const char *location);
 void fi_verify_pointer(void *ptr, void *expected, const char *location);
 void fi_verify_branch(int condition, int expected, const char *location);
 
+// Failure paths of the verify functions, kept out of line so that the
+// fast paths stay small enough to inline (-fi-harden-inline-runtime)
+FI_COLD void fi_mismatch_int32(int32_t value, int32_t expected, const char *location);
+FI_COLD void fi_mismatch_int64(int64_t value, int64_t expected, const char *location);
+FI_COLD void fi_mismatch_pointer(void *ptr, void *expected, const char *location);
+FI_COLD void fi_mismatch_branch(int condition, int expected, const char *location);
+
+// Statistics counting, also out of line: the counters are private to the
+// runtime, so every check only touches memory hardened code cannot see.
+// Never inlined into the fast paths, or they would touch the counters
+// themselves and -fi-harden-inline-runtime could not link them
+typedef enum {
+  FI_VERIFY_INT32,
+  FI_VERIFY_INT64,
+  FI_VERIFY_POINTER,
+  FI_VERIFY_BRANCH,
+  FI_VERIFY_ASYNC     // Done by the checker thread
+} fi_verify_kind_t;
+
+FI_NOINLINE void fi_count_verification(fi_verify_kind_t kind);
+
+// Asynchronous checking (-fi-harden-async, FIAsyncRuntime.cpp). The
+// fi_async_verify_* functions take the same arguments as fi_verify_* but
+// only queue the pair for a trailing checker thread; fi_async_check_op
+// queues the operands and result of an operation the checker recomputes.
+// fi_async_sync() returns once everything the calling thread queued has
+// been checked; the transform calls it before output leaves the process.
+typedef enum {
+  FI_ASYNC_UDIV = 0,
+  FI_ASYNC_SDIV = 1,
+  FI_ASYNC_UREM = 2,
+  FI_ASYNC_SREM = 3
+} fi_async_op_t;
+
+void fi_async_verify_int32(int32_t value, int32_t expected, const char *location);
+void fi_async_verify_int64(int64_t value, int64_t expected, const char *location);
+void fi_async_verify_pointer(void *ptr, void *expected, const char *location);
+void fi_async_verify_branch(int condition, int expected, const char *location);
+void fi_async_check_op(uint32_t op, uint32_t width, uint64_t lhs, uint64_t rhs,
+                       uint64_t result, const char *location);
+void fi_async_sync(void);
+
+// Output-commit checking (-fi-harden-output-commit). The fi_sticky_verify_*
+// functions take the same arguments as fi_verify_* but never fail: they OR
+// the difference into the calling thread's sticky error word. The transform
+// calls fi_output_commit before data leaves the process (write, send,
+// fwrite, fclose, printf, exit, ...); it reports a set sticky word and any
+// checksummed region inside the outgoing buffer that no longer matches.
+void fi_sticky_verify_int32(int32_t value, int32_t expected, const char *location);
+void fi_sticky_verify_int64(int64_t value, int64_t expected, const char *location);
+void fi_sticky_verify_pointer(void *ptr, void *expected, const char *location);
+void fi_sticky_verify_branch(int condition, int expected, const char *location);
+void fi_output_commit(const void *buf, size_t size, const char *location);
+
+// Deferred store verification (-fi-harden-deferred-stores). Hardened
+// stores append their address, value (in the low bytes of its slot) and
+// size (1, 2, 4 or 8) to a log on the caller's stack; fi_store_log_flush
+// re-reads every entry, reports those whose memory no longer holds the
+// logged value unless a later entry overwrote them, and empties the log.
+// The arrays are kept separate so that, for a log of 8-byte stores, the
+// common all-match pass is a gather and compare (AVX2 on x86-64; a scalar
+// loop otherwise).
+#define FI_STORE_LOG_ENTRIES 16  // A power of two
+
+typedef struct {
+  void *addr[FI_STORE_LOG_ENTRIES];
+  uint64_t value[FI_STORE_LOG_ENTRIES];
+  uint8_t size[FI_STORE_LOG_ENTRIES];
+  uint32_t count;
+} fi_store_log_t;
+
+void fi_store_log_flush(fi_store_log_t *log, const char *location);
+
+// Process-level redundancy (FIReplicaRuntime.cpp). With FI_REPLICAS=2|3
+// the program runs as that many replicas whose write()/send() (linked with
+// -Wl,--wrap=write,--wrap=send), stdout/stderr and exit status are voted on
+// before they leave the process. Returns this replica's index, or -1.
+int fi_replica_id(void);
+
 // Checksum-based memory protection
 void fi_checksum_update(void *addr, size_t size);
 int fi_checksum_verify(void *addr, size_t size);
@@ -42,12 +130,31 @@ void fi_runtime_print_stats(void);
 typedef enum {
   FI_ERROR_ABORT,     // Abort on mismatch (default)
   FI_ERROR_LOG,       // Log but continue
-  FI_ERROR_CORRECT    // Attempt correction
+  FI_ERROR_CORRECT,   // Attempt correction
+  FI_ERROR_EXIT       // Exit with FI_DETECTED_EXIT_CODE (fault injection trials)
 } fi_error_mode_t;
 
+// Exit status of a trial process whose fault was caught by a check
+#define FI_DETECTED_EXIT_CODE 86
+
 void fi_set_error_mode(fi_error_mode_t mode);
 fi_error_mode_t fi_get_error_mode(void);
 
+// Binary detection trace: with FI_TRACE_OUT=file set, every failed check
+// appends one fixed-size record there with a single write(). The check ID
+// is the "#N" suffix of the location string the transform passes in;
+// fi-symbolize maps it to file:line:col through -fi-harden-site-table.
+#define FI_TRACE_MAGIC    0x52544946u  // "FITR"
+#define FI_TRACE_NO_CHECK 0xffffffffu  // Location without a check ID
+
+typedef struct {
+  uint32_t magic;
+  uint32_t check;      // Check site ID, or FI_TRACE_NO_CHECK
+  uint32_t pid;
+  char type[12];       // Check type, NUL-padded ("int32", "branch", ...)
+  uint64_t sequence;   // Verifications performed before the failure
+} fi_trace_record_t;
+
 // Statistics
 typedef struct {
   uint64_t verifications_performed;
@@ -58,8 +165,12 @@ typedef struct {
   uint64_t branch_verifications;
   uint64_t checksum_verifications;
   uint64_t checksum_failures;
+  uint64_t async_verifications;  // Done by the checker thread
+  uint64_t commit_verifications; // Output-commit points passed
+  uint64_t store_log_verifications; // Logged stores re-read by a flush
 } fi_runtime_stats_t;
 
+// Snapshot of the counters, refreshed by every call
 const fi_runtime_stats_t *fi_get_stats(void);
 
 #ifdef __cplusplus
@@ -7,6 +7,9 @@
 // 3. Inserting calls to runtime verification functions
 // 4. Protecting memory operations with checksums
 
+#include "FIHardeningRuntime.h"
+#include "FIInjectionPass.h"
+#include "FIVulnerabilityAnalysis.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
@@ -20,11 +23,31 @@
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include <algorithm>
+#include <climits>
+#include <functional>
 #include <set>
 #include <map>
 #include <vector>
@@ -92,6 +115,90 @@ static cl::opt<unsigned> HardenLevel(
     cl::desc("Hardening aggressiveness level (0=minimal, 1=moderate, 2=aggressive, 3=maximum)"),
     cl::init(3));
 
+static cl::opt<std::string> SizeBudget(
+    "fi-harden-size-budget",
+    cl::desc("Per-function code-size budget for hardening: a percentage of the "
+             "original size (e.g. 25%) or an absolute instruction count (e.g. 400)"),
+    cl::init(""));
+
+static cl::opt<bool> SkipSafe(
+    "fi-harden-skip-safe",
+    cl::desc("Do not harden loads, stores, arithmetic and temporaries whose "
+             "faults cannot reach a branch, escaped memory or a return"),
+    cl::init(true));
+
+static cl::opt<unsigned> SDCTop(
+    "fi-harden-sdc-top",
+    cl::desc("Only harden loads, stores, arithmetic and temporaries in the top N% "
+             "of each function by estimated SDC propensity (default 100)"),
+    cl::init(100));
+
+static cl::opt<bool> SelfTest(
+    "fi-harden-self-test",
+    cl::desc("Self-test build: tag every shadow copy for a runtime-selected "
+             "corruption hook inserted by fi-selftest-hooks (fi-campaign --self-test)"),
+    cl::init(false));
+
+static cl::opt<std::string> SelfTestMap(
+    "fi-harden-self-test-map",
+    cl::desc("Write the self-test site table to this file"),
+    cl::init(""));
+
+static cl::opt<std::string> SiteTable(
+    "fi-harden-site-table",
+    cl::desc("Write the check site table (check ID -> source location) to this file"),
+    cl::init(""));
+
+static cl::opt<std::string> InlineRuntime(
+    "fi-harden-inline-runtime",
+    cl::desc("Link the verify fast paths from this FIHardeningRuntime.bc into the "
+             "module as always-inline functions"),
+    cl::init(""));
+
+static cl::opt<bool> Async(
+    "fi-harden-async",
+    cl::desc("Queue checks to a trailing checker thread instead of verifying "
+             "inline; the program waits for it before producing output"),
+    cl::init(false));
+
+static cl::opt<bool> LoadAddress(
+    "fi-harden-load-address",
+    cl::desc("Verify the address computation of loads instead of loading twice; "
+             "volatile and annotate(\"fi_reread\") memory keeps one re-read"),
+    cl::init(false));
+
+static cl::opt<bool> DeferredStores(
+    "fi-harden-deferred-stores",
+    cl::desc("Log (address, value) pairs of hardened stores in a per-function "
+             "store log and verify them in one batch at the next sync point "
+             "instead of reading each store back"),
+    cl::init(false));
+
+static cl::opt<bool> FrameChecksum(
+    "fi-harden-frame-checksum",
+    cl::desc("Protect critical locals with one incremental XOR checksum per "
+             "frame, verified at returns and before indirect and output calls, "
+             "instead of a redundant copy of each"),
+    cl::init(false));
+
+static cl::opt<bool> LoopTripCount(
+    "fi-harden-loop-trip-count",
+    cl::desc("Count loop iterations in a shadow counter and check it at each "
+             "loop exit against the trip count computed by ScalarEvolution"),
+    cl::init(false));
+
+static cl::opt<bool> Diverse(
+    "fi-harden-diverse",
+    cl::desc("Compute shadow copies (cond.dup, temp_dup, TMR clones) with "
+             "algebraically equivalent instructions instead of exact clones"),
+    cl::init(false));
+
+static cl::opt<bool> OutputCommit(
+    "fi-harden-output-commit",
+    cl::desc("Fold check results into a sticky per-thread error word and verify "
+             "it, and the outgoing buffer, only before output leaves the process"),
+    cl::init(false));
+
 static cl::opt<bool> ShowStats(
     "fi-harden-stats",
     cl::desc("Show transformation statistics"),
@@ -108,6 +215,7 @@ namespace {
 struct TransformStats {
   unsigned BranchesHardened = 0;
   unsigned LoadsHardened = 0;
+  unsigned LoadAddressesVerified = 0;
   unsigned StoresHardened = 0;
   unsigned ArithmeticHardened = 0;
   unsigned VerificationCallsAdded = 0;
@@ -117,6 +225,10 @@ struct TransformStats {
   // New strategy statistics
   unsigned IndirectCallsHardened = 0;
   unsigned CriticalVariablesProtected = 0;
+  unsigned FrameChecksumVariables = 0;
+  unsigned LoopsCounted = 0;
+  unsigned LoopExitChecks = 0;
+  unsigned FrameChecksumChecks = 0;
   unsigned BoundsChecksAdded = 0;
   unsigned ReturnAddressesProtected = 0;
   unsigned ExceptionPathsHardened = 0;
@@ -130,6 +242,27 @@ struct TransformStats {
   unsigned TemporariesProtected = 0;
   unsigned LLFIHardenedFunctions = 0;
   
+  // Code-size budget statistics
+  unsigned InstructionsBefore = 0;
+  unsigned InstructionsAfter = 0;
+  unsigned CandidatesOverBudget = 0;
+  
+  // Instructions FIVulnerabilityAnalysis found safe or ranked low
+  unsigned SafeInstructionsSkipped = 0;
+  unsigned LowSDCSkipped = 0;
+  
+  // Self-test statistics
+  unsigned SelfTestSites = 0;
+  
+  // Asynchronous checking statistics
+  unsigned AsyncRecomputedOps = 0;
+  unsigned AsyncSyncPoints = 0;
+  
+  // Output-commit statistics
+  unsigned CommitPoints = 0;
+  unsigned StoresLogged = 0;
+  unsigned StoreLogFlushPoints = 0;
+  
   void print(raw_ostream &OS) {
     OS << "\n========================================\n";
     OS << "FI Hardening Transformation Statistics\n";
@@ -137,11 +270,21 @@ struct TransformStats {
     OS << "Basic Hardening:\n";
     OS << "  Branches hardened:          " << BranchesHardened << "\n";
     OS << "  Loads hardened:             " << LoadsHardened << "\n";
+    if (LoadAddress)
+      OS << "  Load addresses verified:    " << LoadAddressesVerified << "\n";
     OS << "  Stores hardened:            " << StoresHardened << "\n";
     OS << "  Arithmetic ops hardened:    " << ArithmeticHardened << "\n";
     OS << "\nAdvanced Hardening:\n";
     OS << "  Indirect calls hardened:    " << IndirectCallsHardened << "\n";
     OS << "  Critical vars protected:    " << CriticalVariablesProtected << "\n";
+    if (LoopTripCount) {
+      OS << "  Loops counted:              " << LoopsCounted << "\n";
+      OS << "  Loop exit checks:           " << LoopExitChecks << "\n";
+    }
+    if (FrameChecksum) {
+      OS << "  Frame-checksummed vars:     " << FrameChecksumVariables << "\n";
+      OS << "  Frame-checksum checks:      " << FrameChecksumChecks << "\n";
+    }
     OS << "  Bounds checks added:        " << BoundsChecksAdded << "\n";
     OS << "  Return addrs protected:     " << ReturnAddressesProtected << "\n";
     OS << "  Exception paths hardened:   " << ExceptionPathsHardened << "\n";
@@ -157,6 +300,29 @@ struct TransformStats {
     OS << "  Verification calls added:   " << VerificationCallsAdded << "\n";
     OS << "  Instructions duplicated:    " << InstructionsDuplicated << "\n";
     OS << "  Basic blocks split:         " << BasicBlocksSplit << "\n";
+    if (SelfTestSites > 0)
+      OS << "  Self-test sites:            " << SelfTestSites << "\n";
+    if (Async) {
+      OS << "  Async recomputed ops:       " << AsyncRecomputedOps << "\n";
+      OS << "  Async sync points:          " << AsyncSyncPoints << "\n";
+    }
+    if (OutputCommit)
+      OS << "  Output-commit points:       " << CommitPoints << "\n";
+    if (DeferredStores) {
+      OS << "  Stores logged:              " << StoresLogged << "\n";
+      OS << "  Store-log flush points:     " << StoreLogFlushPoints << "\n";
+    }
+    OS << "\nCode Size:\n";
+    OS << "  Instructions before:        " << InstructionsBefore << "\n";
+    OS << "  Instructions after:         " << InstructionsAfter << "\n";
+    if (InstructionsBefore > 0) {
+      double Growth = (double)(InstructionsAfter - InstructionsBefore) /
+                      InstructionsBefore * 100.0;
+      OS << "  Size growth:                " << format("%.1f%%", Growth) << "\n";
+    }
+    OS << "  Candidates over budget:     " << CandidatesOverBudget << "\n";
+    OS << "  Safe instructions skipped:  " << SafeInstructionsSkipped << "\n";
+    OS << "  Low-SDC candidates skipped: " << LowSDCSkipped << "\n";
     OS << "========================================\n";
     
     unsigned totalTransforms = BranchesHardened + LoadsHardened + 
@@ -170,10 +336,67 @@ struct TransformStats {
   }
 };
 
+// Instructions collected for hardening in one function
+struct HardeningWorklist {
+  std::vector<BranchInst*> Branches;
+  std::vector<LoadInst*> Loads;
+  std::vector<StoreInst*> Stores;
+  std::vector<BinaryOperator*> Arithmetic;
+  std::vector<CallInst*> IndirectCalls;
+  std::vector<AllocaInst*> Variables;
+  std::vector<GetElementPtrInst*> MemoryAccesses;
+  std::vector<LandingPadInst*> ExceptionPaths;
+  std::vector<LoadInst*> VolatileLoads;
+  
+  size_t size() const {
+    return Branches.size() + Loads.size() + Stores.size() + Arithmetic.size() +
+           IndirectCalls.size() + Variables.size() + MemoryAccesses.size() +
+           ExceptionPaths.size() + VolatileLoads.size();
+  }
+};
+
 class FIHardeningTransform : public PassInfoMixin<FIHardeningTransform> {
 private:
   TransformStats Stats;
+
+  // Hardening candidates competing for the -fi-harden-size-budget
+  enum class CandidateKind {
+    Entry, Branch, Load, Store, Arithmetic, IndirectCall, CriticalVariable,
+    BoundsCheck, ExceptionPath, VolatileLoad, Timing, Phi, TMR, Temporary,
+    OutputPoint, StoreLog, LoopTripCount
+  };
+
+  struct HardeningCandidate {
+    CandidateKind Kind;
+    Instruction *Inst;  // Entry hardening is keyed on the first entry instruction,
+                        // a loop's counter on its header's terminator
+    unsigned Cost;      // Upper bound on instructions added
+    unsigned Value;     // Relative protection value
+  };
+
+  // Fault impact of the current function's original instructions, and the
+  // lowest SDC propensity still hardened under -fi-harden-sdc-top (-1: all)
+  const FIVulnerabilityInfo *Vulnerability = nullptr;
+  float SDCCutoff = -1.0f;
+
+  // Candidates selected for the current function when a budget is active
+  bool BudgetActive = false;
+  DenseSet<std::pair<Instruction *, unsigned>> BudgetSelection;
+  // Loops of the unmodified function, for ranking loop counters
+  LoopInfo *BudgetLoops = nullptr;
+  ScalarEvolution *BudgetSE = nullptr;
   
+  friend class FISelfTestHooks;  // Shares setRuntimeAttributes
+
+  // Every runtime check inserted, numbered in insertion order
+  struct CheckSite {
+    unsigned ID;
+    std::string Function;
+    std::string Kind;       // branch, load, store, arithmetic, phi, temp:<op>, ...
+    std::string Location;   // file:line:col of the checked instruction, or "-"
+  };
+  std::vector<CheckSite> CheckSites;
+
   // Runtime function declarations (linked from libFIHardeningRuntime.a)
   FunctionCallee VerifyInt32Func;
   FunctionCallee VerifyInt64Func;
@@ -190,6 +413,19 @@ private:
   FunctionCallee VerifyReturnAddrFunc;    // Stack: Return address verification
   FunctionCallee ValidateHardwareIOFunc;  // Hardware: I/O validation
   FunctionCallee AddTimingNoiseFunc;      // Timing: Side-channel mitigation
+  FunctionCallee AsyncCheckOpFunc;        // Async: Queue an op for recomputation
+  FunctionCallee AsyncSyncFunc;           // Async: Wait for the checker
+  FunctionCallee OutputCommitFunc;        // Output commit: Check before output
+  FunctionCallee StoreLogFlushFunc;       // Deferred stores: Verify the log
+  
+  // The verify entry point for Type under the active checking mode
+  static std::string verifyFunctionName(const char *Type) {
+    if (Async)
+      return std::string("fi_async_verify_") + Type;
+    if (OutputCommit)
+      return std::string("fi_sticky_verify_") + Type;
+    return std::string("fi_verify_") + Type;
+  }
   
   // Helper to get or create runtime functions
   void initializeRuntimeFunctions(Module &M) {
@@ -202,23 +438,27 @@ private:
     
     FunctionType *VerifyInt32Ty = FunctionType::get(
         VoidTy, {Int32Ty, Int32Ty, Int8PtrTy}, false);
-    VerifyInt32Func = M.getOrInsertFunction("fi_verify_int32", VerifyInt32Ty);
+    VerifyInt32Func = M.getOrInsertFunction(
+        verifyFunctionName("int32"), VerifyInt32Ty);
     
     // void fi_verify_int64(int64_t value, int64_t expected, const char *location)
     Type *Int64Ty = Type::getInt64Ty(Ctx);
     FunctionType *VerifyInt64Ty = FunctionType::get(
         VoidTy, {Int64Ty, Int64Ty, Int8PtrTy}, false);
-    VerifyInt64Func = M.getOrInsertFunction("fi_verify_int64", VerifyInt64Ty);
+    VerifyInt64Func = M.getOrInsertFunction(
+        verifyFunctionName("int64"), VerifyInt64Ty);
     
     // void fi_verify_pointer(void *ptr, void *expected, const char *location)
     FunctionType *VerifyPtrTy = FunctionType::get(
         VoidTy, {Int8PtrTy, Int8PtrTy, Int8PtrTy}, false);
-    VerifyPointerFunc = M.getOrInsertFunction("fi_verify_pointer", VerifyPtrTy);
+    VerifyPointerFunc = M.getOrInsertFunction(
+        verifyFunctionName("pointer"), VerifyPtrTy);
     
     // void fi_verify_branch(int condition, int expected, const char *location)
     FunctionType *VerifyBranchTy = FunctionType::get(
         VoidTy, {Int32Ty, Int32Ty, Int8PtrTy}, false);
-    VerifyBranchFunc = M.getOrInsertFunction("fi_verify_branch", VerifyBranchTy);
+    VerifyBranchFunc = M.getOrInsertFunction(
+        verifyFunctionName("branch"), VerifyBranchTy);
     
     // void fi_checksum_update(void *addr, size_t size)
     Type *SizeTy = Type::getInt64Ty(Ctx);
@@ -267,22 +507,283 @@ private:
     // void fi_add_timing_noise(void)
     FunctionType *TimingNoiseTy = FunctionType::get(VoidTy, {}, false);
     AddTimingNoiseFunc = M.getOrInsertFunction("fi_add_timing_noise", TimingNoiseTy);
+    
+    // void fi_async_check_op(uint32_t op, uint32_t width, uint64_t lhs,
+    //                        uint64_t rhs, uint64_t result, const char *location)
+    // void fi_async_sync(void)
+    if (Async) {
+      FunctionType *CheckOpTy = FunctionType::get(
+          VoidTy, {Int32Ty, Int32Ty, Int64Ty, Int64Ty, Int64Ty, Int8PtrTy}, false);
+      AsyncCheckOpFunc = M.getOrInsertFunction("fi_async_check_op", CheckOpTy);
+      AsyncSyncFunc = M.getOrInsertFunction("fi_async_sync", TimingNoiseTy);
+    }
+    
+    // void fi_output_commit(const void *buf, size_t size, const char *location)
+    if (OutputCommit) {
+      FunctionType *CommitTy = FunctionType::get(
+          VoidTy, {Int8PtrTy, SizeTy, Int8PtrTy}, false);
+      OutputCommitFunc = M.getOrInsertFunction("fi_output_commit", CommitTy);
+    }
+    
+    // void fi_store_log_flush(fi_store_log_t *log, const char *location)
+    if (DeferredStores) {
+      StoreLogTy = StructType::getTypeByName(Ctx, "fi_store_log_t");
+      if (!StoreLogTy) {
+        StoreLogTy = StructType::create(
+            Ctx, {ArrayType::get(Int8PtrTy, FI_STORE_LOG_ENTRIES),
+                  ArrayType::get(Int64Ty, FI_STORE_LOG_ENTRIES),
+                  ArrayType::get(Type::getInt8Ty(Ctx), FI_STORE_LOG_ENTRIES), Int32Ty},
+            "fi_store_log_t");
+      }
+      FunctionType *FlushTy = FunctionType::get(
+          VoidTy, {Int8PtrTy, Int8PtrTy}, false);
+      StoreLogFlushFunc = M.getOrInsertFunction("fi_store_log_flush", FlushTy);
+    }
+    
+    // What the runtime actually does (audited in FIHardeningRuntime.cpp):
+    // checks touch only runtime-private state (statistics, tables, stdio,
+    // the trace) and read their pointer arguments; the ones that can fail
+    // may abort or exit, so only those that cannot are willreturn
+    MemoryEffects Private = MemoryEffects::inaccessibleMemOnly();
+    MemoryEffects Check = Private | MemoryEffects::argMemOnly(ModRefInfo::Ref);
+    if (Async) {
+      // Queuing keeps the location for the checker. Not willreturn: it
+      // waits while the ring is full, and checks inline (and may fail) when
+      // the thread has no ring
+      setRuntimeAttributes(VerifyInt32Func, Check, false);
+      setRuntimeAttributes(VerifyInt64Func, Check, false);
+      setRuntimeAttributes(VerifyPointerFunc, Check, false);
+      setRuntimeAttributes(VerifyBranchFunc, Check, false);
+      setRuntimeAttributes(AsyncCheckOpFunc, Check, false);
+      setRuntimeAttributes(AsyncSyncFunc, Private, false);
+    } else if (OutputCommit) {
+      // Sticky checks cannot fail; the commit point can
+      setRuntimeAttributes(VerifyInt32Func, Check, true, {2});
+      setRuntimeAttributes(VerifyInt64Func, Check, true, {2});
+      setRuntimeAttributes(VerifyPointerFunc, Check, true, {2});
+      setRuntimeAttributes(VerifyBranchFunc, Check, true, {2});
+    } else {
+      setRuntimeAttributes(VerifyInt32Func, Check, false, {2});
+      setRuntimeAttributes(VerifyInt64Func, Check, false, {2});
+      setRuntimeAttributes(VerifyPointerFunc, Check, false, {2});
+      setRuntimeAttributes(VerifyBranchFunc, Check, false, {2});
+    }
+    if (Function *Update = setRuntimeAttributes(ChecksumUpdateFunc, Check, true))
+      Update->addParamAttr(0, Attribute::ReadOnly);  // Captured in the table
+    setRuntimeAttributes(ChecksumVerifyFunc, Check, false, {0});
+    if (OutputCommit)
+      setRuntimeAttributes(OutputCommitFunc, Check, false, {0, 2});
+    if (DeferredStores) {
+      // Reads the logged addresses, which may be any memory, and resets the log
+      if (Function *Flush = setRuntimeAttributes(
+              StoreLogFlushFunc, Private | MemoryEffects::readOnly() |
+                                     MemoryEffects::argMemOnly(), false, {1}))
+        Flush->addParamAttr(0, Attribute::NoCapture);
+    }
+    setRuntimeAttributes(VerifyCFIFunc, Check, false, {2});
+    setRuntimeAttributes(LogFaultFunc, Check, false, {0});
+    setRuntimeAttributes(CheckBoundsFunc, Private, false);
+    setRuntimeAttributes(ProtectReturnAddrFunc, Check, true, {0});
+    setRuntimeAttributes(VerifyReturnAddrFunc, Check, false, {0});
+    setRuntimeAttributes(ValidateHardwareIOFunc, MemoryEffects::unknown(), false);  // Volatile MMIO read
+    setRuntimeAttributes(AddTimingNoiseFunc, Private, true);
+  }
+  
+  // Without attributes LLVM has to assume every check reads and writes all
+  // memory and may unwind, so LICM, GVN and vectorization stop at each one.
+  // ReadArgs are pointer parameters only read and never captured.
+  static Function *setRuntimeAttributes(FunctionCallee Callee, MemoryEffects ME,
+                                        bool WillReturn,
+                                        std::initializer_list<unsigned> ReadArgs = {}) {
+    // A prior declaration with a different type is left alone
+    auto *F = dyn_cast<Function>(Callee.getCallee());
+    if (!F)
+      return nullptr;
+    F->setDoesNotThrow();
+    F->setMemoryEffects(ME);
+    if (WillReturn)
+      F->setWillReturn();
+    for (unsigned Arg : ReadArgs) {
+      F->addParamAttr(Arg, Attribute::ReadOnly);
+      F->addParamAttr(Arg, Attribute::NoCapture);
+    }
+    return F;
+  }
+  
+  // ===== SELF-TEST SUPPORT =====
+  //
+  // Self-test builds only tag their shadow copies here: a !fi.selftest
+  // (site, salt) node on the shadow, and one !fi.selftest.sites entry per
+  // site. fi-selftest-hooks inserts the corruption hooks once the optimizer
+  // is done with the shadows (see FISelfTestHooks below).
+  
+  // Register a shadow copy as a self-test site: (ID, function, kind, width,
+  // location), the columns of the self-test map
+  unsigned addSelfTestSite(Function &F, Instruction *Anchor, StringRef Kind,
+                           Type *Ty) {
+    Module &M = *F.getParent();
+    LLVMContext &Ctx = M.getContext();
+    NamedMDNode *Sites = M.getOrInsertNamedMetadata("fi.selftest.sites");
+    unsigned ID = Sites->getNumOperands();
+    unsigned Width = Ty->isPointerTy() ? M.getDataLayout().getPointerSizeInBits()
+                                       : Ty->getIntegerBitWidth();
+    std::string Location = "-";
+    if (const DebugLoc &DLoc = Anchor->getDebugLoc())
+      Location = (DLoc->getFilename() + ":" + Twine(DLoc.getLine()) + ":" +
+                  Twine(DLoc.getCol())).str();
+    Type *Int32Ty = Type::getInt32Ty(Ctx);
+    Sites->addOperand(MDNode::get(
+        Ctx, {ConstantAsMetadata::get(ConstantInt::get(Int32Ty, ID)),
+              MDString::get(Ctx, F.getName()), MDString::get(Ctx, Kind),
+              ConstantAsMetadata::get(ConstantInt::get(Int32Ty, Width)),
+              MDString::get(Ctx, Location)}));
+    Stats.SelfTestSites++;
+    return ID;
   }
   
-  // Create a constant string for location information
-  Value *createLocationString(IRBuilder<> &Builder, Module &M, 
-                             const std::string &FuncName, 
+  static bool isSelfTestable(Type *Ty) {
+    return (Ty->isIntegerTy() && Ty->getIntegerBitWidth() <= 64) ||
+           Ty->isPointerTy();
+  }
+  
+  static void tagSelfTestShadow(Instruction *Shadow, unsigned Site, unsigned Salt = 0) {
+    LLVMContext &Ctx = Shadow->getContext();
+    Type *Int32Ty = Type::getInt32Ty(Ctx);
+    Shadow->setMetadata("fi.selftest",
+                        MDNode::get(Ctx, {ConstantAsMetadata::get(ConstantInt::get(Int32Ty, Site)),
+                                          ConstantAsMetadata::get(ConstantInt::get(Int32Ty, Salt))}));
+  }
+  
+  // The value a check should compare against: the shadow itself, tagged as
+  // a site in self-test builds. A shadow that is a constant or an argument
+  // has no computation a fault could hit and is no site.
+  Value *selfTestShadow(Value *Shadow, Function &F, Instruction *Anchor, StringRef Kind) {
+    auto *I = dyn_cast<Instruction>(Shadow);
+    if (SelfTest && I && isSelfTestable(Shadow->getType()))
+      tagSelfTestShadow(I, addSelfTestSite(F, Anchor, Kind, Shadow->getType()));
+    return Shadow;
+  }
+  
+  // Constant location string "function:kind#ID" for a check on Anchor. The
+  // ID indexes the -fi-harden-site-table entry holding Anchor's DILocation,
+  // so the runtime never formats source positions itself.
+  Value *createLocationString(IRBuilder<> &Builder, Instruction *Anchor,
                              const std::string &InstType) {
-    std::string location = FuncName + ":" + InstType;
+    CheckSite Site;
+    Site.ID = CheckSites.size();
+    Site.Function = Anchor->getFunction()->getName().str();
+    Site.Kind = InstType;
+    Site.Location = "-";
+    if (const DebugLoc &DLoc = Anchor->getDebugLoc())
+      Site.Location = (DLoc->getFilename() + ":" + Twine(DLoc.getLine()) + ":" +
+                       Twine(DLoc.getCol())).str();
+    CheckSites.push_back(Site);
+    std::string location = Site.Function + ":" + InstType + "#" + std::to_string(Site.ID);
     return Builder.CreateGlobalStringPtr(location);
   }
   
+  // Check ID -> source location, read by fi-symbolize
+  void writeSiteTable(raw_ostream &OS) {
+    OS << "# check\tkind\tfunction\tlocation\n";
+    for (const CheckSite &Site : CheckSites)
+      OS << Site.ID << "\t" << Site.Kind << "\t" << Site.Function << "\t"
+         << Site.Location << "\n";
+  }
+  
+  // ===== RUNTIME INLINING =====
+  
+  // True if C refers to runtime state that has no exported symbol. Linking
+  // it would give the module a private copy that diverges from the
+  // archive's (constants such as format strings are fine to copy).
+  static bool usesPrivateState(const Value *C) {
+    if (auto *GV = dyn_cast<GlobalValue>(C)) {
+      auto *Var = dyn_cast<GlobalVariable>(GV);
+      return GV->hasLocalLinkage() && !(Var && Var->isConstant());
+    }
+    if (auto *CE = dyn_cast<ConstantExpr>(C))
+      for (const Value *Op : CE->operands())
+        if (usesPrivateState(Op))
+          return true;
+    return false;
+  }
+  
+  // Link the verify fast paths of -fi-harden-inline-runtime into M as
+  // internal always-inline definitions so they are optimized together with
+  // the hardened code. Everything else in the bitcode is reduced to
+  // declarations and still comes from libFIHardeningRuntime.a. The
+  // fi_sticky_verify_* functions are nothing but private state updates and
+  // stay out of line.
+  void linkRuntimeFastPaths(Module &M) {
+    static const char *const FastPaths[] = {
+        "fi_verify_int32", "fi_verify_int64", "fi_verify_pointer", "fi_verify_branch"};
+    
+    SMDiagnostic Err;
+    std::unique_ptr<Module> Runtime = parseIRFile(InlineRuntime, Err, M.getContext());
+    if (!Runtime) {
+      errs() << "  [ERROR] Cannot load runtime bitcode '" << InlineRuntime
+             << "': " << Err.getMessage() << "\n";
+      return;
+    }
+    
+    std::set<std::string> Linked;
+    for (const char *Name : FastPaths) {
+      Function *Decl = M.getFunction(Name);
+      Function *Def = Runtime->getFunction(Name);
+      if (!Decl || Decl->use_empty() || !Def || Def->isDeclaration())
+        continue;
+      bool Private = false;
+      for (Instruction &I : instructions(*Def))
+        for (Value *Op : I.operands())
+          Private |= isa<Constant>(Op) && usesPrivateState(Op);
+      if (Private) {
+        errs() << "  [InlineRuntime] Not inlining " << Name
+               << ": it uses runtime state that is not exported\n";
+        continue;
+      }
+      Linked.insert(Name);
+    }
+    if (Linked.empty())
+      return;
+    
+    for (Function &RF : *Runtime)
+      if (!RF.isDeclaration() && !Linked.count(RF.getName().str()))
+        RF.deleteBody();
+    for (GlobalVariable &GV : Runtime->globals())
+      if (!GV.hasLocalLinkage() && GV.hasInitializer()) {
+        GV.setInitializer(nullptr);
+        GV.setLinkage(GlobalValue::ExternalLinkage);
+        GV.setComdat(nullptr);
+      }
+    
+    if (Linker::linkModules(M, std::move(Runtime), Linker::Flags::LinkOnlyNeeded)) {
+      errs() << "  [ERROR] Cannot link runtime bitcode '" << InlineRuntime << "'\n";
+      return;
+    }
+    for (const std::string &Name : Linked) {
+      Function *F = M.getFunction(Name);
+      F->setLinkage(GlobalValue::InternalLinkage);
+      F->removeFnAttr(Attribute::NoInline);
+      F->removeFnAttr(Attribute::OptimizeNone);
+      F->addFnAttr(Attribute::AlwaysInline);
+    }
+    // The counting call the fast paths keep touches only the runtime's
+    // private statistics
+    if (Function *Count = M.getFunction("fi_count_verification"))
+      setRuntimeAttributes(Count, MemoryEffects::inaccessibleMemOnly(), true);
+    errs() << "  [InlineRuntime] Linked " << Linked.size()
+           << " verify fast path(s) from " << InlineRuntime << "\n";
+  }
+  
   // Skip intrinsic and debug instructions
   bool shouldSkipInstruction(Instruction &I) {
     // Skip debug instructions
     if (isa<DbgInfoIntrinsic>(&I))
       return true;
     
+    // Skip bookkeeping of the store log and frame checksum
+    if (BookkeepingCode.count(&I))
+      return true;
+    
     // Skip exception handling
     if (isa<LandingPadInst>(&I) || isa<ResumeInst>(&I))
       return true;
@@ -302,6 +803,129 @@ private:
     return false;
   }
   
+  // V passed through an empty inline asm whose output is tied to its input.
+  // It costs no machine instruction, but no pass can see that the result
+  // equals V, so whatever is computed from it is neither folded nor merged
+  // with the same computation on V. Only for values that fit a general
+  // purpose register; anything else is returned unchanged.
+  static Value *createOpaqueCopy(IRBuilder<> &Builder, Value *V, const Twine &Name = "") {
+    Type *Ty = V->getType();
+    Type *RegTy = Ty;
+    if (auto *IntTy = dyn_cast<IntegerType>(Ty)) {
+      const DataLayout &DL = Builder.GetInsertBlock()->getModule()->getDataLayout();
+      unsigned Bits = IntTy->getBitWidth();
+      unsigned RegBits = DL.getLargestLegalIntTypeSizeInBits();
+      if (Bits > (RegBits ? RegBits : 64))  // No native integers: assume 64-bit
+        return V;
+      if (Bits != 32 && Bits != 64 && !DL.isLegalInteger(Bits))  // i1 and other odd widths
+        RegTy = Builder.getIntNTy(Bits <= 32 ? 32 : 64);
+    } else if (!Ty->isPointerTy()) {
+      return V;
+    }
+    InlineAsm *Barrier = InlineAsm::get(FunctionType::get(RegTy, {RegTy}, false), "",
+                                        "=r,0", /*hasSideEffects=*/false);
+    Value *In = RegTy == Ty ? V : Builder.CreateZExt(V, RegTy);
+    CallInst *Copy = Builder.CreateCall(Barrier, {In}, RegTy == Ty ? Name : Twine());
+    Copy->setDoesNotAccessMemory();
+    Copy->setDoesNotThrow();
+    return RegTy == Ty ? Copy : Builder.CreateTrunc(Copy, Ty, Name);
+  }
+  
+  // -fi-harden-diverse: I recomputed in an algebraically equivalent form.
+  // Exact clones are merged with the original by CSE (at the latest by the
+  // instruction selector) and share its functional unit. InstCombine folds
+  // most of these forms straight back to I, so one inner term of each goes
+  // through createOpaqueCopy; the rest of the form then stays as written.
+  // Variant selects one of two forms so the TMR clones differ from each
+  // other, down to which term is opaque. Null if there is no diverse form.
+  Value *createDiverseShadow(IRBuilder<> &Builder, Instruction *I, unsigned Variant,
+                             const Twine &Name) {
+    auto Opaque = [&](Value *V) { return createOpaqueCopy(Builder, V); };
+    if (auto *Cmp = dyn_cast<ICmpInst>(I)) {
+      Value *A = Cmp->getOperand(0), *B = Cmp->getOperand(1);
+      CmpInst::Predicate Pred = Cmp->getPredicate();
+      if (!A->getType()->isIntOrIntVectorTy())
+        return Builder.CreateICmp(CmpInst::getSwappedPredicate(Pred), B, Opaque(A), Name);
+      if (Cmp->isEquality()) {
+        // a == b  <=>  (a ^ b) <u 1
+        Value *Diff = Opaque(Builder.CreateXor(A, B));
+        Constant *Zero = Constant::getNullValue(A->getType());
+        return Pred == CmpInst::ICMP_EQ
+                   ? Builder.CreateICmpULT(Diff, ConstantInt::get(A->getType(), 1), Name)
+                   : Builder.CreateICmpUGT(Diff, Zero, Name);
+      }
+      // a <s b  <=>  (b ^ SignBit) >u (a ^ SignBit), and likewise for the
+      // other orderings: swapped operands, the opposite signedness
+      Constant *SignBit = ConstantInt::get(
+          A->getType(), APInt::getSignMask(A->getType()->getScalarSizeInBits()));
+      CmpInst::Predicate Other = Cmp->isSigned() ? ICmpInst::getUnsignedPredicate(Pred)
+                                                 : ICmpInst::getSignedPredicate(Pred);
+      return Builder.CreateICmp(CmpInst::getSwappedPredicate(Other),
+                                Builder.CreateXor(B, SignBit),
+                                Opaque(Builder.CreateXor(A, SignBit)), Name);
+    }
+    
+    auto *BO = dyn_cast<BinaryOperator>(I);
+    if (!BO || !BO->getType()->isIntOrIntVectorTy())
+      return nullptr;
+    Value *A = BO->getOperand(0), *B = BO->getOperand(1);
+    Type *Ty = BO->getType();
+    Constant *One = ConstantInt::get(Ty, 1);
+    bool V0 = Variant % 2 == 0;
+    switch (BO->getOpcode()) {
+    case Instruction::Add:
+      // (a ^ b) + ((a & b) << 1)  |  (a | b) + (a & b)
+      return V0 ? Builder.CreateAdd(Builder.CreateXor(A, B),
+                                    Builder.CreateShl(Opaque(Builder.CreateAnd(A, B)), One),
+                                    Name)
+                : Builder.CreateAdd(Opaque(Builder.CreateOr(A, B)), Builder.CreateAnd(A, B),
+                                    Name);
+    case Instruction::Sub:
+      // (a ^ b) - ((~a & b) << 1)  |  (a & ~b) - (~a & b)
+      return V0 ? Builder.CreateSub(
+                      Builder.CreateXor(A, B),
+                      Builder.CreateShl(Opaque(Builder.CreateAnd(Builder.CreateNot(A), B)), One),
+                      Name)
+                : Builder.CreateSub(Opaque(Builder.CreateAnd(A, Builder.CreateNot(B))),
+                                    Builder.CreateAnd(Builder.CreateNot(A), B), Name);
+    case Instruction::Xor:
+      // (a | b) - (a & b)  |  (a | b) & ~(a & b)
+      return V0 ? Builder.CreateSub(Opaque(Builder.CreateOr(A, B)), Builder.CreateAnd(A, B),
+                                    Name)
+                : Builder.CreateAnd(Builder.CreateOr(A, B),
+                                    Builder.CreateNot(Opaque(Builder.CreateAnd(A, B))), Name);
+    case Instruction::Or:
+      // (a ^ b) + (a & b)  |  (a + b) - (a & b)
+      return V0 ? Builder.CreateAdd(Builder.CreateXor(A, B), Opaque(Builder.CreateAnd(A, B)),
+                                    Name)
+                : Builder.CreateSub(Opaque(Builder.CreateAdd(A, B)), Builder.CreateAnd(A, B),
+                                    Name);
+    case Instruction::And:
+      // (a | b) - (a ^ b)  |  (a + b) - (a | b)
+      return V0 ? Builder.CreateSub(Builder.CreateOr(A, B), Opaque(Builder.CreateXor(A, B)),
+                                    Name)
+                : Builder.CreateSub(Builder.CreateAdd(A, B), Opaque(Builder.CreateOr(A, B)),
+                                    Name);
+    case Instruction::Mul: {
+      if (!V0) {
+        // -(~a * b) - b
+        Value *Product = Builder.CreateMul(Opaque(Builder.CreateNot(A)), B);
+        return Builder.CreateSub(Builder.CreateNeg(Product), B, Name);
+      }
+      // a * 2^k as two shifts by k-1 and an add (the multiplier is not used
+      // at all), otherwise (-a) * (-b)
+      auto *C = dyn_cast<ConstantInt>(B);
+      if (C && C->getValue().isPowerOf2() && C->getValue().ugt(1)) {
+        Value *Half = Opaque(Builder.CreateShl(A, C->getValue().logBase2() - 1));
+        return Builder.CreateAdd(Half, Half, Name);
+      }
+      return Builder.CreateMul(Opaque(Builder.CreateNeg(A)), Builder.CreateNeg(B), Name);
+    }
+    default:
+      return nullptr;
+    }
+  }
+  
   // Harden a conditional branch with redundant checks
   void hardenBranch(BranchInst *BI, Function &F) {
     if (!BI->isConditional())
@@ -312,23 +936,25 @@ private:
       return;
     
     IRBuilder<> Builder(BI);
-    Module *M = F.getParent();
     
     Value *Condition = BI->getCondition();
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), "branch");
+    Value *Location = createLocationString(Builder, BI, "branch");
     
     // Strategy 1: Duplicate condition evaluation
-    Value *CondDup = Builder.CreateICmp(
-        cast<ICmpInst>(Condition)->getPredicate(),
-        cast<ICmpInst>(Condition)->getOperand(0),
-        cast<ICmpInst>(Condition)->getOperand(1),
-        "cond.dup");
+    Value *CondDup = Diverse ? createDiverseShadow(Builder, cast<ICmpInst>(Condition),
+                                                   0, "cond.dup")
+                             : Builder.CreateICmp(
+                                   cast<ICmpInst>(Condition)->getPredicate(),
+                                   cast<ICmpInst>(Condition)->getOperand(0),
+                                   cast<ICmpInst>(Condition)->getOperand(1),
+                                   "cond.dup");
     
     Stats.InstructionsDuplicated++;
     
     // Strategy 2: Verify both conditions match
+    Value *CondCheck = selfTestShadow(CondDup, F, BI, "cond.dup");
     Value *Cond1Int = Builder.CreateZExt(Condition, Builder.getInt32Ty());
-    Value *Cond2Int = Builder.CreateZExt(CondDup, Builder.getInt32Ty());
+    Value *Cond2Int = Builder.CreateZExt(CondCheck, Builder.getInt32Ty());
     
     Builder.CreateCall(VerifyBranchFunc, {Cond1Int, Cond2Int, Location});
     Stats.VerificationCallsAdded++;
@@ -342,17 +968,113 @@ private:
     errs() << "  [Transform] Hardened branch in function '" << F.getName() << "'\n";
   }
   
+  // Objects marked __attribute__((annotate("fi_reread"))): memory that can
+  // change underneath the program, which -fi-harden-load-address re-reads
+  DenseSet<const Value*> ReReadObjects;
+  const Module *ReReadModule = nullptr;
+  
+  static bool isReReadAnnotation(Value *Str) {
+    auto *GV = dyn_cast<GlobalVariable>(Str->stripPointerCasts());
+    auto *Data = GV && GV->hasInitializer()
+                     ? dyn_cast<ConstantDataSequential>(GV->getInitializer())
+                     : nullptr;
+    return Data && Data->isCString() && Data->getAsCString() == "fi_reread";
+  }
+  
+  // Annotated globals (llvm.global.annotations) and locals (llvm.var.annotation)
+  void collectReReadObjects(Function &F) {
+    Module *M = F.getParent();
+    if (ReReadModule != M) {
+      ReReadModule = M;
+      ReReadObjects.clear();
+      if (GlobalVariable *Annotations = M->getGlobalVariable("llvm.global.annotations"))
+        if (auto *Entries = dyn_cast<ConstantArray>(Annotations->getInitializer()))
+          for (Value *Entry : Entries->operands())
+            if (auto *Annotation = dyn_cast<ConstantStruct>(Entry))
+              if (Annotation->getNumOperands() >= 2 &&
+                  isReReadAnnotation(Annotation->getOperand(1)))
+                ReReadObjects.insert(Annotation->getOperand(0)->stripPointerCasts());
+    }
+    for (Instruction &I : instructions(F))
+      if (auto *II = dyn_cast<IntrinsicInst>(&I))
+        if (II->getIntrinsicID() == Intrinsic::var_annotation &&
+            isReReadAnnotation(II->getArgOperand(1)))
+          ReReadObjects.insert(getUnderlyingObject(II->getArgOperand(0)));
+  }
+  
+  bool needsReRead(LoadInst *LI) {
+    return LI->isVolatile() ||
+           ReReadObjects.count(getUnderlyingObject(LI->getPointerOperand()));
+  }
+  
+  // The GEP chain that computes Addr, recomputed up to the first non-GEP
+  // base. A plain clone would be merged with the original by CSE, so every
+  // variable index is taken through an opaque copy, and with OpaqueBase the
+  // base as well; the address arithmetic is then really done twice.
+  Value *cloneAddress(IRBuilder<> &Builder, Value *Addr, bool OpaqueBase,
+                      unsigned Depth = 0) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(Addr);
+    if (!GEP || Depth >= 4)
+      return OpaqueBase ? createOpaqueCopy(Builder, Addr, Addr->getName() + ".base") : Addr;
+    Value *Base = cloneAddress(Builder, GEP->getPointerOperand(), OpaqueBase, Depth + 1);
+    auto *Dup = cast<GetElementPtrInst>(GEP->clone());
+    Dup->setOperand(GetElementPtrInst::getPointerOperandIndex(), Base);
+    for (Use &Idx : Dup->indices())
+      if (!isa<Constant>(Idx))
+        Idx.set(createOpaqueCopy(Builder, Idx, GEP->getName() + ".idx"));
+    Stats.InstructionsDuplicated++;
+    return Builder.Insert(Dup, GEP->getName() + ".addr.dup");
+  }
+  
+  // True if a GEP in the chain cloneAddress recomputes has a variable index
+  static bool hasVariableIndex(Value *Addr, unsigned Depth = 0) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(Addr);
+    if (!GEP || Depth >= 4)
+      return false;
+    return any_of(GEP->indices(), [](Value *Idx) { return !isa<Constant>(Idx); }) ||
+           hasVariableIndex(GEP->getPointerOperand(), Depth + 1);
+  }
+  
+  // -fi-harden-load-address: the value is loaded once; what is checked is
+  // the address, recomputed and verified before the access, so a corrupted
+  // index or base never reaches memory. Loads from a plain base (argument,
+  // global, alloca, loaded pointer) have no computation to verify.
+  void hardenLoadAddress(LoadInst *LI, Function &F) {
+    auto *GEP = dyn_cast<GetElementPtrInst>(LI->getPointerOperand());
+    if (!GEP)
+      return;
+    
+    IRBuilder<> Builder(LI);
+    Value *Location = createLocationString(Builder, LI, "load.addr");
+    Value *AddrDup = cloneAddress(Builder, GEP, !hasVariableIndex(GEP));
+    Value *AddrCheck = selfTestShadow(AddrDup, F, LI, "addr.dup");
+    Type *Int8PtrTy = PointerType::getUnqual(Builder.getInt8Ty());
+    Builder.CreateCall(VerifyPointerFunc, {Builder.CreateBitCast(GEP, Int8PtrTy),
+                                           Builder.CreateBitCast(AddrCheck, Int8PtrTy),
+                                           Location});
+    Stats.VerificationCallsAdded++;
+    Stats.LoadAddressesVerified++;
+    Stats.LoadsHardened++;
+    
+    if (HardenLevel >= 2)
+      errs() << "  [Transform] Verified load address in function '" << F.getName() << "'\n";
+  }
+  
   // Harden a load instruction with verification
   void hardenLoad(LoadInst *LI, Function &F) {
     // Only harden based on level
     if (HardenLevel == 0 && !isInCriticalPath(LI))
       return;
     
+    if (LoadAddress && !needsReRead(LI)) {
+      hardenLoadAddress(LI, F);
+      return;
+    }
+    
     IRBuilder<> Builder(LI->getNextNode());
-    Module *M = F.getParent();
     
     Value *LoadedValue = LI;
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), "load");
+    Value *Location = createLocationString(Builder, LI, "load");
     
     // Strategy 1: Duplicate load and verify
     IRBuilder<> LoadBuilder(LI);
@@ -365,22 +1087,27 @@ private:
     
     // Strategy 2: Verify loaded values match
     Type *LoadType = LI->getType();
+    bool Checked = LoadType->isIntegerTy(32) || LoadType->isIntegerTy(64) ||
+                   LoadType->isPointerTy();
+    Value *LoadCheck = Checked ? selfTestShadow(LoadDup, F, LI, "load.dup")
+                               : LoadDup;
     
     if (LoadType->isIntegerTy(32)) {
-      Builder.CreateCall(VerifyInt32Func, {LoadedValue, LoadDup, Location});
+      Builder.CreateCall(VerifyInt32Func, {LoadedValue, LoadCheck, Location});
       Stats.VerificationCallsAdded++;
     } else if (LoadType->isIntegerTy(64)) {
-      Builder.CreateCall(VerifyInt64Func, {LoadedValue, LoadDup, Location});
+      Builder.CreateCall(VerifyInt64Func, {LoadedValue, LoadCheck, Location});
       Stats.VerificationCallsAdded++;
     } else if (LoadType->isPointerTy()) {
       Value *Ptr1 = Builder.CreateBitCast(LoadedValue, PointerType::getUnqual(Builder.getInt8Ty()));
-      Value *Ptr2 = Builder.CreateBitCast(LoadDup, PointerType::getUnqual(Builder.getInt8Ty()));
+      Value *Ptr2 = Builder.CreateBitCast(LoadCheck, PointerType::getUnqual(Builder.getInt8Ty()));
       Builder.CreateCall(VerifyPointerFunc, {Ptr1, Ptr2, Location});
       Stats.VerificationCallsAdded++;
     }
     
-    // Strategy 3: Use majority voting for critical loads (level 3)
-    if (HardenLevel >= 3) {
+    // Strategy 3: Use majority voting for critical loads (level 3); a
+    // single re-read is all -fi-harden-load-address keeps
+    if (HardenLevel >= 3 && !LoadAddress) {
       // Create third load
       LoadInst *LoadDup2 = Builder.CreateLoad(
           LI->getType(), LI->getPointerOperand(), "load.dup2");
@@ -412,26 +1139,34 @@ private:
     
     Value *StoredValue = SI->getValueOperand();
     Value *StorePtr = SI->getPointerOperand();
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), "store");
-    
-    // Strategy 1: Verify store by reading back
-    LoadInst *VerifyLoad = Builder.CreateLoad(
-        SI->getValueOperand()->getType(), StorePtr, "store.verify");
-    VerifyLoad->setAlignment(SI->getAlign());
+    Value *Location = createLocationString(Builder, SI, "store");
     
     Type *ValueType = StoredValue->getType();
     
-    if (ValueType->isIntegerTy(32)) {
-      Builder.CreateCall(VerifyInt32Func, {VerifyLoad, StoredValue, Location});
-      Stats.VerificationCallsAdded++;
-    } else if (ValueType->isIntegerTy(64)) {
-      Builder.CreateCall(VerifyInt64Func, {VerifyLoad, StoredValue, Location});
-      Stats.VerificationCallsAdded++;
-    } else if (ValueType->isPointerTy()) {
-      Value *Ptr1 = Builder.CreateBitCast(VerifyLoad, PointerType::getUnqual(Builder.getInt8Ty()));
-      Value *Ptr2 = Builder.CreateBitCast(StoredValue, PointerType::getUnqual(Builder.getInt8Ty()));
-      Builder.CreateCall(VerifyPointerFunc, {Ptr1, Ptr2, Location});
-      Stats.VerificationCallsAdded++;
+    // Strategy 1: Verify store by reading back, or log it for a batched
+    // check at the next sync point (self-test needs the inline shadow)
+    bool Deferred = LogStores && isLoggable(SI);
+    if (!Deferred) {
+      LoadInst *VerifyLoad = Builder.CreateLoad(ValueType, StorePtr, "store.verify");
+      VerifyLoad->setAlignment(SI->getAlign());
+      
+      bool Checked = ValueType->isIntegerTy(32) || ValueType->isIntegerTy(64) ||
+                     ValueType->isPointerTy();
+      Value *StoreCheck = Checked ? selfTestShadow(VerifyLoad, F, SI, "store.verify")
+                                  : VerifyLoad;
+      
+      if (ValueType->isIntegerTy(32)) {
+        Builder.CreateCall(VerifyInt32Func, {StoreCheck, StoredValue, Location});
+        Stats.VerificationCallsAdded++;
+      } else if (ValueType->isIntegerTy(64)) {
+        Builder.CreateCall(VerifyInt64Func, {StoreCheck, StoredValue, Location});
+        Stats.VerificationCallsAdded++;
+      } else if (ValueType->isPointerTy()) {
+        Value *Ptr1 = Builder.CreateBitCast(StoreCheck, PointerType::getUnqual(Builder.getInt8Ty()));
+        Value *Ptr2 = Builder.CreateBitCast(StoredValue, PointerType::getUnqual(Builder.getInt8Ty()));
+        Builder.CreateCall(VerifyPointerFunc, {Ptr1, Ptr2, Location});
+        Stats.VerificationCallsAdded++;
+      }
     }
     
     // Strategy 2: Update checksum for memory region (level 2+)
@@ -445,12 +1180,191 @@ private:
       Stats.VerificationCallsAdded++;
     }
     
+    // Last, as appending may split the block
+    if (Deferred)
+      appendToStoreLog(SI, &*Builder.GetInsertPoint(), Location, F);
+    
     Stats.StoresHardened++;
     
     if (HardenLevel >= 2)
       errs() << "  [Transform] Hardened store in function '" << F.getName() << "'\n";
   }
   
+  // ===== DEFERRED STORE VERIFICATION =====
+  //
+  // A read-back right after a store is served from the store buffer, so it
+  // costs latency and sees little. With -fi-harden-deferred-stores each
+  // hardened store appends (address, value, size) to a stack-resident
+  // fi_store_log_t instead, and fi_store_log_flush re-reads all entries in
+  // one pass at the next sync point: before returns, before calls and
+  // intrinsics that may write memory, before program writes that were not
+  // logged, and when the log is full.
+  
+  StructType *StoreLogTy = nullptr;
+  AllocaInst *StoreLog = nullptr;            // This function's log, if any
+  bool LogStores = false;                    // The log fits the size budget
+  DenseSet<const Instruction*> BookkeepingCode;  // Not re-hardened by LLFI
+  DenseSet<const Instruction*> OriginalWrites;
+  DenseSet<const Instruction*> LoggedStores;
+  
+  bool isLoggable(StoreInst *SI) {
+    Type *Ty = SI->getValueOperand()->getType();
+    if (!SI->isSimple() || !(Ty->isIntegerTy() || Ty->isPointerTy() || Ty->isFloatingPointTy()))
+      return false;
+    uint64_t Size = SI->getModule()->getDataLayout().getTypeStoreSize(Ty);
+    return Size == 1 || Size == 2 || Size == 4 || Size == 8;
+  }
+  
+  AllocaInst *getStoreLog(Function &F) {
+    if (StoreLog)
+      return StoreLog;
+    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+    StoreLog = Builder.CreateAlloca(StoreLogTy, nullptr, "store.log");
+    Value *CountPtr = Builder.CreateStructGEP(StoreLogTy, StoreLog, 3, "store.log.count");
+    Builder.CreateStore(Builder.getInt32(0), CountPtr);
+    BookkeepingCode.insert(cast<Instruction>(CountPtr));
+    return StoreLog;
+  }
+  
+  void appendToStoreLog(StoreInst *SI, Instruction *InsertBefore, Value *Location,
+                        Function &F) {
+    AllocaInst *Log = getStoreLog(F);
+    IRBuilder<> Builder(SI);
+    Value *CountPtr = Builder.CreateStructGEP(StoreLogTy, Log, 3, "store.log.count");
+    Value *Count = Builder.CreateLoad(Builder.getInt32Ty(), CountPtr, "store.log.n");
+    Value *Full = Builder.CreateICmpEQ(Count, Builder.getInt32(FI_STORE_LOG_ENTRIES));
+    
+    // A full log is verified and emptied before the store, which may
+    // overwrite a logged location
+    Instruction *FlushTerm = SplitBlockAndInsertIfThen(
+        Full, SI, false, MDBuilder(F.getContext()).createBranchWeights(1, 1000));
+    IRBuilder<> FlushBuilder(FlushTerm);
+    FlushBuilder.CreateCall(StoreLogFlushFunc, {Log, Location});
+    Stats.BasicBlocksSplit++;
+    
+    // The slot is masked so that a corrupted count cannot write past the
+    // log; the runtime reports a count out of range
+    Builder.SetInsertPoint(InsertBefore);
+    Value *Index = Builder.CreateSelect(Full, Builder.getInt32(0), Count);
+    Value *Slot = Builder.CreateZExt(
+        Builder.CreateAnd(Index, Builder.getInt32(FI_STORE_LOG_ENTRIES - 1)),
+        Builder.getInt64Ty());
+    Value *Zero = Builder.getInt64(0);
+    
+    // Pointer and value are logged as stored, without casts that would
+    // themselves need protecting; the value fills the low bytes of its slot
+    Value *Stored = SI->getValueOperand();
+    uint64_t Size = F.getParent()->getDataLayout().getTypeStoreSize(Stored->getType());
+    Builder.CreateStore(SI->getPointerOperand(),
+                        Builder.CreateInBoundsGEP(StoreLogTy, Log,
+                                                  {Zero, Builder.getInt32(0), Slot}));
+    Builder.CreateStore(Stored, Builder.CreateInBoundsGEP(StoreLogTy, Log,
+                                                          {Zero, Builder.getInt32(1), Slot}));
+    Builder.CreateStore(Builder.getInt8(Size),
+                        Builder.CreateInBoundsGEP(StoreLogTy, Log,
+                                                  {Zero, Builder.getInt32(2), Slot}));
+    Builder.CreateStore(Builder.CreateAdd(Index, Builder.getInt32(1)), CountPtr);
+    
+    // The append on both sides of the split
+    for (auto *I = cast<Instruction>(CountPtr); !I->isTerminator(); I = I->getNextNode())
+      BookkeepingCode.insert(I);
+    for (auto *I = cast<Instruction>(Index); I != InsertBefore; I = I->getNextNode())
+      BookkeepingCode.insert(I);
+    LoggedStores.insert(SI);
+    Stats.StoresLogged++;
+  }
+  
+  // Sync points of the store log: anything after which a logged location
+  // may legitimately hold another value, and function exit
+  bool isStoreLogSyncPoint(Instruction &I) {
+    if (isa<ReturnInst>(I) || isa<ResumeInst>(I))
+      return true;
+    if (auto *CB = dyn_cast<CallBase>(&I)) {
+      Function *Callee = CB->getCalledFunction();
+      return !CB->onlyReadsMemory() && !(Callee && Callee->getName().starts_with("fi_"));
+    }
+    return OriginalWrites.count(&I) && !LoggedStores.count(&I);
+  }
+  
+  // The flushes are all needed once anything is logged, so they are not
+  // charged one by one: the StoreLog budget candidate covers all of them
+  void insertStoreLogFlushes(Function &F) {
+    std::vector<Instruction*> SyncPoints;
+    for (Instruction &I : instructions(F))
+      if (isStoreLogSyncPoint(I))
+        SyncPoints.push_back(&I);
+    for (Instruction *I : SyncPoints) {
+      IRBuilder<> Builder(I);
+      Builder.CreateCall(StoreLogFlushFunc,
+                         {StoreLog, createLocationString(Builder, I, "store.log")});
+      Stats.VerificationCallsAdded++;
+      Stats.StoreLogFlushPoints++;
+    }
+  }
+  
+  // Calls through which data leaves the process: the async checker must
+  // have caught up, and output-commit mode verifies the sticky error word
+  // and the outgoing buffer, right before each one
+  static bool isOutputCall(CallInst *CI) {
+    static const StringSet<> OutputFunctions = {
+        "printf", "fprintf", "vprintf", "vfprintf", "dprintf", "puts",
+        "fputs", "putchar", "putc", "fputc", "fwrite", "fflush", "fclose",
+        "write", "pwrite", "writev", "send", "sendto", "sendmsg",
+        "exit", "_exit", "abort"};
+    Function *Callee = CI->getCalledFunction();
+    return Callee && Callee->isDeclaration() && OutputFunctions.count(Callee->getName());
+  }
+  
+  void insertOutputPoints(Function &F) {
+    std::vector<CallInst*> Calls;
+    for (Instruction &I : instructions(F))
+      if (auto *CI = dyn_cast<CallInst>(&I))
+        if (isOutputCall(CI) && withinBudget(CandidateKind::OutputPoint, CI))
+          Calls.push_back(CI);
+    for (CallInst *CI : Calls) {
+      IRBuilder<> Builder(CI);
+      if (Async) {
+        Builder.CreateCall(AsyncSyncFunc);
+        Stats.AsyncSyncPoints++;
+      }
+      if (OutputCommit) {
+        Value *Buffer, *Size;
+        getOutputBuffer(Builder, CI, Buffer, Size);
+        Value *Location = createLocationString(Builder, CI, "commit");
+        Builder.CreateCall(OutputCommitFunc, {Buffer, Size, Location});
+        Stats.VerificationCallsAdded++;
+        Stats.CommitPoints++;
+      }
+    }
+  }
+  
+  // The buffer an output call writes, or null for formatted output, closes
+  // and exits (only the sticky word is checked there)
+  static void getOutputBuffer(IRBuilder<> &Builder, CallInst *CI, Value *&Buffer,
+                              Value *&Size) {
+    StringRef Name = CI->getCalledFunction()->getName();
+    Type *SizeTy = Builder.getInt64Ty();
+    Buffer = ConstantPointerNull::get(PointerType::getUnqual(Builder.getInt8Ty()));
+    Size = ConstantInt::get(SizeTy, 0);
+    auto IsPointer = [&](unsigned Arg) {
+      return CI->arg_size() > Arg && CI->getArgOperand(Arg)->getType()->isPointerTy();
+    };
+    auto IsInteger = [&](unsigned Arg) {
+      return CI->arg_size() > Arg && CI->getArgOperand(Arg)->getType()->isIntegerTy();
+    };
+    if ((Name == "write" || Name == "pwrite" || Name == "send" || Name == "sendto") &&
+        IsPointer(1) && IsInteger(2)) {
+      // write(fd, buf, count), send(fd, buf, len, flags)
+      Buffer = CI->getArgOperand(1);
+      Size = Builder.CreateZExtOrTrunc(CI->getArgOperand(2), SizeTy);
+    } else if (Name == "fwrite" && IsPointer(0) && IsInteger(1) && IsInteger(2)) {
+      // fwrite(ptr, size, nmemb, stream)
+      Buffer = CI->getArgOperand(0);
+      Size = Builder.CreateMul(Builder.CreateZExtOrTrunc(CI->getArgOperand(1), SizeTy),
+                               Builder.CreateZExtOrTrunc(CI->getArgOperand(2), SizeTy));
+    }
+  }
+  
   // Harden arithmetic operations (division, modulo) against faults
   void hardenArithmetic(BinaryOperator *BO, Function &F) {
     if (!HardenArithmetic || HardenLevel < 2)
@@ -464,20 +1378,44 @@ private:
       return;
     
     IRBuilder<> Builder(BO->getNextNode());
-    Module *M = F.getParent();
     
     // Duplicate operation
     Value *Op1 = BO->getOperand(0);
     Value *Op2 = BO->getOperand(1);
     
+    // Async: the checker thread redoes the division instead of this thread
+    // (self-test builds keep the shadow so it can be corrupted)
+    Type *ResType = BO->getType();
+    if (Async && !SelfTest && ResType->isIntegerTy() &&
+        ResType->getIntegerBitWidth() <= 64) {
+      uint32_t Op = BO->getOpcode() == Instruction::UDiv ? FI_ASYNC_UDIV
+                  : BO->getOpcode() == Instruction::SDiv ? FI_ASYNC_SDIV
+                  : BO->getOpcode() == Instruction::URem ? FI_ASYNC_UREM
+                                                         : FI_ASYNC_SREM;
+      Value *Location = createLocationString(Builder, BO, "arithmetic");
+      Type *Int64Ty = Builder.getInt64Ty();
+      Builder.CreateCall(AsyncCheckOpFunc,
+                         {Builder.getInt32(Op),
+                          Builder.getInt32(ResType->getIntegerBitWidth()),
+                          Builder.CreateZExt(Op1, Int64Ty),
+                          Builder.CreateZExt(Op2, Int64Ty),
+                          Builder.CreateZExt(BO, Int64Ty), Location});
+      Stats.VerificationCallsAdded++;
+      Stats.AsyncRecomputedOps++;
+      Stats.ArithmeticHardened++;
+      errs() << "  [Transform] Hardened arithmetic in function '" << F.getName() << "'\n";
+      return;
+    }
+    
     Value *ResultDup = Builder.CreateBinOp(
         BO->getOpcode(), Op1, Op2, "arith.dup");
     Stats.InstructionsDuplicated++;
     
     // Verify results match
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), "arithmetic");
+    Value *Location = createLocationString(Builder, BO, "arithmetic");
     
-    Type *ResType = BO->getType();
+    if (ResType->isIntegerTy(32) || ResType->isIntegerTy(64))
+      ResultDup = selfTestShadow(ResultDup, F, BO, "arith.dup");
     if (ResType->isIntegerTy(32)) {
       Builder.CreateCall(VerifyInt32Func, {BO, ResultDup, Location});
       Stats.VerificationCallsAdded++;
@@ -503,8 +1441,7 @@ private:
       return; // Direct call, already safe
     
     IRBuilder<> Builder(CI);
-    Module *M = F.getParent();
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), "indirect_call");
+    Value *Location = createLocationString(Builder, CI, "indirect_call");
     
     // Get expected function pointer (from data-flow or type)
     // For now, we verify it matches expectations at runtime
@@ -549,6 +1486,9 @@ private:
     if (!isCritical)
       return;
     
+    if (FrameChecksum && addToFrameChecksum(AI, F))
+      return;
+    
     IRBuilder<> Builder(AI->getNextNode());
     Module *M = F.getParent();
     
@@ -570,6 +1510,275 @@ private:
     errs() << "  [Transform] Protected critical variable with redundancy\n";
   }
   
+  // ===== PER-FRAME CHECKSUM =====
+  //
+  // With -fi-harden-frame-checksum the critical locals of a frame share one
+  // i64 word holding the XOR of their values, each rotated by its own
+  // amount so that equal bit flips in two locals do not cancel. A store
+  // folds (old ^ new) into the word, so the redundant work per store is one
+  // checksum update however many locals are protected; returns, indirect
+  // calls and output calls recompute the XOR and verify it.
+  //
+  // A local enters the word at its first store, which folds in the new value
+  // alone. No zero store is added ahead of it, so the local is neither
+  // written by code the pass would then harden nor hidden from MSan, and a
+  // check point only recomputes the locals whose first store dominates it.
+  
+  struct FrameChecksumVar {
+    AllocaInst *Local;
+    unsigned Rotation;
+    SmallPtrSet<Instruction*, 8> SeededPoints;  // Check points the local is in
+  };
+  
+  AllocaInst *FrameChecksumSlot = nullptr;   // This frame's checksum word
+  std::vector<FrameChecksumVar> FrameChecksumVars;
+  std::vector<Instruction*> FrameChecksumPoints;
+  
+  // Rotated, zero-extended image of V in the checksum word
+  Value *foldIntoChecksum(IRBuilder<> &Builder, Value *V, unsigned Rotation) {
+    Type *Int64Ty = Builder.getInt64Ty();
+    V = V->getType()->isPointerTy() ? Builder.CreatePtrToInt(V, Int64Ty)
+                                    : Builder.CreateZExt(V, Int64Ty);
+    if (Rotation == 0)
+      return V;
+    return Builder.CreateIntrinsic(Intrinsic::fshl, {Int64Ty},
+                                   {V, V, Builder.getInt64(Rotation)});
+  }
+  
+  static bool isFrameChecksumPoint(Instruction &I) {
+    auto *CI = dyn_cast<CallInst>(&I);
+    return isa<ReturnInst>(I) || (CI && (CI->isIndirectCall() || isOutputCall(CI)));
+  }
+  
+  // Only scalar locals that are loaded and stored and never escape: nothing
+  // else can change them behind the checksum's back. The first store must
+  // dominate the others and run at most once, and every check point must
+  // either be dominated by it or be unreachable from it, so the word holds
+  // the local exactly when the check point includes it.
+  bool addToFrameChecksum(AllocaInst *AI, Function &F) {
+    Type *Ty = AI->getAllocatedType();
+    if (!AI->isStaticAlloca() || !(Ty->isPointerTy() ||
+                                   (Ty->isIntegerTy() && Ty->getIntegerBitWidth() <= 64)))
+      return false;
+    std::vector<StoreInst*> Stores;
+    for (User *U : AI->users()) {
+      // Runtime calls (fi_checksum_update) and the deferred-store log only
+      // read the local
+      auto *CI = dyn_cast<CallInst>(U);
+      Function *Callee = CI ? CI->getCalledFunction() : nullptr;
+      if ((Callee && Callee->getName().starts_with("fi_")) ||
+          BookkeepingCode.count(cast<Instruction>(U)))
+        continue;
+      if (auto *SI = dyn_cast<StoreInst>(U)) {
+        if (SI->getPointerOperand() != AI || !SI->isSimple() ||
+            SI->getValueOperand()->getType() != Ty)
+          return false;
+        Stores.push_back(SI);
+      } else if (auto *LI = dyn_cast<LoadInst>(U)) {
+        if (!LI->isSimple() || LI->getType() != Ty)
+          return false;
+      } else {
+        return false;
+      }
+    }
+    if (Stores.empty())
+      return false;
+    
+    DominatorTree DT(F);
+    StoreInst *Seed = nullptr;
+    for (StoreInst *SI : Stores)
+      if (llvm::all_of(Stores, [&](StoreInst *Other) {
+            return Other == SI || DT.dominates(SI, Other);
+          }))
+        Seed = SI;
+    if (!Seed)
+      return false;
+    BasicBlock *SeedBB = Seed->getParent();
+    SmallVector<BasicBlock*, 4> SeedSuccs(successors(SeedBB));
+    if (!SeedSuccs.empty() &&
+        isPotentiallyReachableFromMany(SeedSuccs, SeedBB, nullptr, &DT))
+      return false;
+    
+    if (!FrameChecksumSlot)
+      for (Instruction &I : instructions(F))
+        if (isFrameChecksumPoint(I))
+          FrameChecksumPoints.push_back(&I);
+    SmallPtrSet<Instruction*, 8> SeededPoints;
+    for (Instruction *P : FrameChecksumPoints) {
+      if (DT.dominates(Seed, P))
+        SeededPoints.insert(P);
+      else if (isPotentiallyReachable(Seed, P, nullptr, &DT))
+        return false;
+    }
+    
+    if (!FrameChecksumSlot) {
+      IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+      FrameChecksumSlot = Builder.CreateAlloca(Builder.getInt64Ty(), nullptr, "frame.checksum");
+      BookkeepingCode.insert(Builder.CreateStore(Builder.getInt64(0), FrameChecksumSlot));
+    }
+    unsigned Rotation = (FrameChecksumVars.size() * 13) % 64;
+    FrameChecksumVars.push_back({AI, Rotation, std::move(SeededPoints)});
+    
+    IRBuilder<> Builder(Seed);
+    for (StoreInst *SI : Stores) {
+      Instruction *Prev = SI->getPrevNode();
+      Builder.SetInsertPoint(SI);
+      // The first store folds in the new value alone, later ones old ^ new
+      Value *Image = SI->getValueOperand();
+      if (SI != Seed)
+        Image = Builder.CreateXor(Builder.CreateLoad(Ty, AI, AI->getName() + ".old"), Image);
+      Value *Delta = foldIntoChecksum(Builder, Image, Rotation);
+      Value *Sum = Builder.CreateLoad(Builder.getInt64Ty(), FrameChecksumSlot);
+      Builder.CreateStore(Builder.CreateXor(Sum, Delta), FrameChecksumSlot);
+      for (Instruction *I = Prev ? Prev->getNextNode() : &SI->getParent()->front();
+           I != SI; I = I->getNextNode())
+        BookkeepingCode.insert(I);
+    }
+    
+    Stats.CriticalVariablesProtected++;
+    Stats.FrameChecksumVariables++;
+    if (HardenLevel >= 2)
+      errs() << "  [Transform] Added critical variable to the frame checksum\n";
+    return true;
+  }
+  
+  void insertFrameChecksumChecks(Function &F) {
+    for (Instruction *I : FrameChecksumPoints) {
+      Instruction *Prev = I->getPrevNode();
+      IRBuilder<> Builder(I);
+      Value *Location = createLocationString(Builder, I, "frame.checksum");
+      Value *Recomputed = Builder.getInt64(0);
+      for (FrameChecksumVar &Var : FrameChecksumVars)
+        if (Var.SeededPoints.count(I))
+          Recomputed = Builder.CreateXor(
+              Recomputed,
+              foldIntoChecksum(Builder,
+                               Builder.CreateLoad(Var.Local->getAllocatedType(), Var.Local),
+                               Var.Rotation));
+      Value *Sum = Builder.CreateLoad(Builder.getInt64Ty(), FrameChecksumSlot, "frame.checksum.sum");
+      Value *SumCheck = selfTestShadow(Sum, F, I, "frame.checksum");
+      Builder.CreateCall(VerifyInt64Func, {Recomputed, SumCheck, Location});
+      for (Instruction *C = Prev ? Prev->getNextNode() : &I->getParent()->front();
+           C != I; C = C->getNextNode())
+        BookkeepingCode.insert(C);
+      Stats.VerificationCallsAdded++;
+      Stats.FrameChecksumChecks++;
+    }
+  }
+  
+  // ===== LOOP TRIP-COUNT VERIFICATION =====
+  //
+  // A glitch on a loop's exit branch (skipped cipher rounds, a compare loop
+  // cut short) leaves every value consistent with its shadow. With
+  // -fi-harden-loop-trip-count each loop gets a shadow counter of taken
+  // back edges in its header, and every exit whose count ScalarEvolution
+  // can compute checks it against that count, expanded from the loop
+  // bounds in the preheader. Runs once the worklist is collected, so none of
+  // its code is a candidate, on loop and SCEV analyses recomputed for the CFG
+  // that function-level hardening has left.
+  
+  // Exit count of exiting block E that a check can compare the counter
+  // against, expanded in L's preheader, or nullptr if it has none
+  static const SCEV *getCheckableExitCount(Loop *L, BasicBlock *E, ScalarEvolution &SE,
+                                           SCEVExpander &Expander) {
+    auto *BI = dyn_cast<BranchInst>(E->getTerminator());
+    if (!BI || !BI->isConditional())
+      return nullptr;
+    const SCEV *Count = SE.getExitCount(L, E);
+    if (isa<SCEVCouldNotCompute>(Count) || SE.getTypeSizeInBits(Count->getType()) > 64 ||
+        !SE.isLoopInvariant(Count, L) ||
+        !Expander.isSafeToExpandAt(Count, L->getLoopPreheader()->getTerminator()))
+      return nullptr;
+    return Count;
+  }
+  
+  void hardenLoopTripCounts(Function &F, FunctionAnalysisManager &FAM) {
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+    ScalarEvolution SE(F, FAM.getResult<TargetLibraryAnalysis>(F),
+                       FAM.getResult<AssumptionAnalysis>(F), DT, LI);
+    struct ExitCheck {
+      BasicBlock *Exiting;
+      BasicBlock *Exit;
+      Value *Expected;    // i64, shared by the exits with the same count
+    };
+    std::vector<std::pair<Loop*, std::vector<ExitCheck>>> Plans;
+    SCEVExpander Expander(SE, F.getParent()->getDataLayout(), "loop.trip");
+    Type *Int64Ty = Type::getInt64Ty(F.getContext());
+    DenseMap<Value*, Value*> ExpectedChecks;  // One self-test site per expanded count
+    
+    // Expected counts are expanded while SCEV still matches the CFG
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      BasicBlock *Preheader = L->getLoopPreheader();
+      if (!Preheader ||
+          !withinBudget(CandidateKind::LoopTripCount, L->getHeader()->getTerminator()))
+        continue;
+      std::vector<ExitCheck> Exits;
+      SmallVector<BasicBlock*, 4> Exiting;
+      L->getExitingBlocks(Exiting);
+      for (BasicBlock *E : Exiting) {
+        const SCEV *Count = getCheckableExitCount(L, E, SE, Expander);
+        if (!Count)
+          continue;
+        Value *Expanded = Expander.expandCodeFor(Count, Count->getType(),
+                                                 Preheader->getTerminator());
+        Value *&Expected = ExpectedChecks[Expanded];
+        if (!Expected) {
+          IRBuilder<> Builder(Preheader->getTerminator());
+          Expected = Builder.CreateZExt(Expanded, Int64Ty);
+          if (auto *Z = dyn_cast<ZExtInst>(Expected))
+            BookkeepingCode.insert(Z);
+          Expected = selfTestShadow(Expected, F, E->getTerminator(), "loop.trip");
+        }
+        for (BasicBlock *Succ : successors(E))
+          if (!L->contains(Succ))
+            Exits.push_back({E, Succ, Expected});
+      }
+      if (!Exits.empty())
+        Plans.push_back({L, std::move(Exits)});
+    }
+    for (Instruction *I : Expander.getAllInsertedInstructions())
+      BookkeepingCode.insert(I);
+    
+    // Counters first, while loop membership is still accurate
+    std::vector<PHINode*> Counters;
+    for (auto &[L, Exits] : Plans) {
+      BasicBlock *Header = L->getHeader();
+      IRBuilder<> Builder(Header, Header->begin());
+      PHINode *Iter = Builder.CreatePHI(Int64Ty, pred_size(Header), "loop.iter");
+      Builder.SetInsertPoint(&*Header->getFirstInsertionPt());
+      Value *Next = Builder.CreateAdd(Iter, Builder.getInt64(1), "loop.iter.next");
+      for (BasicBlock *Pred : predecessors(Header))
+        Iter->addIncoming(L->contains(Pred) ? Next : Builder.getInt64(0), Pred);
+      BookkeepingCode.insert(Iter);
+      BookkeepingCode.insert(cast<Instruction>(Next));
+      Counters.push_back(Iter);
+      Stats.LoopsCounted++;
+    }
+    
+    // One check on each exit edge: back edges taken == the exit's count
+    for (size_t I = 0; I < Plans.size(); ++I) {
+      for (const ExitCheck &Exit : Plans[I].second) {
+        BasicBlock *Check = SplitEdge(Exit.Exiting, Exit.Exit, nullptr, nullptr,
+                                      nullptr, "loop.exit.check");
+        Instruction *Term = Check->getTerminator();
+        IRBuilder<> Builder(Term);
+        Value *Location = createLocationString(Builder, Exit.Exiting->getTerminator(),
+                                               "loop.trip");
+        Builder.CreateCall(VerifyInt64Func, {Counters[I], Exit.Expected, Location});
+        for (Instruction &C : *Check)
+          BookkeepingCode.insert(&C);
+        Stats.VerificationCallsAdded++;
+        Stats.BasicBlocksSplit++;
+        Stats.LoopExitChecks++;
+      }
+    }
+    
+    if (!Plans.empty())
+      errs() << "  [Transform] Counted " << Plans.size() << " loop(s) in function '"
+             << F.getName() << "'\n";
+  }
+  
   // Strategy 7: Memory Bounds Checking
   void hardenMemoryAccess(GetElementPtrInst *GEP, Function &F) {
     if (!HardenMemorySafety)
@@ -602,7 +1811,8 @@ private:
     Builder.SetInsertPoint(ErrorBB);
     if (EnableFaultLogging) {
       Value *LogMsg = Builder.CreateGlobalStringPtr("Bounds check failed!");
-      Builder.CreateCall(LogFaultFunc, {LogMsg, Builder.getInt32(2)}); // Severity 2 = Error
+      Builder.CreateCall(LogFaultFunc, {LogMsg, Builder.getInt32(2)}) // Severity 2 = Error
+          ->addFnAttr(Attribute::Cold);
     }
     Builder.CreateUnreachable();
     
@@ -656,7 +1866,8 @@ private:
       RetBuilder.SetInsertPoint(ErrorBB);
       if (EnableFaultLogging) {
         Value *LogMsg = RetBuilder.CreateGlobalStringPtr("Return address corrupted!");
-        RetBuilder.CreateCall(LogFaultFunc, {LogMsg, RetBuilder.getInt32(3)}); // Critical
+        RetBuilder.CreateCall(LogFaultFunc, {LogMsg, RetBuilder.getInt32(3)}) // Critical
+            ->addFnAttr(Attribute::Cold);
       }
       RetBuilder.CreateUnreachable();
       
@@ -718,7 +1929,7 @@ private:
     // Add timing noise at strategic points to prevent timing analysis
     for (Instruction &I : BB) {
       if (BranchInst *BI = dyn_cast<BranchInst>(&I)) {
-        if (BI->isConditional()) {
+        if (BI->isConditional() && withinBudget(CandidateKind::Timing, BI)) {
           IRBuilder<> Builder(BI);
           Builder.CreateCall(AddTimingNoiseFunc, {});
           Stats.TimingMitigationsAdded++;
@@ -730,6 +1941,40 @@ private:
     errs() << "  [Transform] Added timing side-channel mitigation\n";
   }
   
+  // True if I is not worth hardening: a fault in it cannot reach a branch,
+  // escaped memory or a return, or it ranks below -fi-harden-sdc-top
+  bool skipCandidate(Instruction *I) {
+    if (!Vulnerability)
+      return false;
+    if (SkipSafe && Vulnerability->isSafe(I)) {
+      Stats.SafeInstructionsSkipped++;
+      return true;
+    }
+    float SDC = Vulnerability->sdcPropensity(I);
+    if (SDCCutoff >= 0 && SDC >= 0 && SDC < SDCCutoff) {
+      Stats.LowSDCSkipped++;
+      return true;
+    }
+    return false;
+  }
+
+  // Propensity of the last instruction inside the top SDCTop% of F
+  float computeSDCCutoff(Function &F) {
+    if (SDCTop >= 100)
+      return -1.0f;
+    std::vector<float> Ranked;
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB)
+        if (isa<StoreInst>(&I) ||
+            (!I.getType()->isVoidTy() && !isa<AllocaInst>(&I) && !isa<CallInst>(&I)))
+          Ranked.push_back(Vulnerability->sdcPropensity(&I));
+    if (Ranked.empty())
+      return -1.0f;
+    std::sort(Ranked.begin(), Ranked.end(), std::greater<float>());
+    size_t Keep = ((size_t)Ranked.size() * SDCTop + 99) / 100;
+    return Keep ? Ranked[Keep - 1] : 2.0f;
+  }
+
   // Determine if instruction is in a critical path (simplified heuristic)
   bool isInCriticalPath(Instruction *I) {
     // Heuristics:
@@ -756,7 +2001,302 @@ private:
     
     return false;
   }
+
+  // Collect the instructions each enabled strategy applies to
+  void collectHardeningWorklist(Function &F, HardeningWorklist &WL) {
+    for (BasicBlock &BB : F) {
+      for (Instruction &I : BB) {
+        if (shouldSkipInstruction(I))
+          continue;
+        
+        if (BranchInst *BI = dyn_cast<BranchInst>(&I)) {
+          if (HardenBranches && BI->isConditional() && isa<ICmpInst>(BI->getCondition()))
+            WL.Branches.push_back(BI);
+        } else if (LoadInst *LI = dyn_cast<LoadInst>(&I)) {
+          if (HardenMemory && !skipCandidate(LI))
+            WL.Loads.push_back(LI);
+          if (HardenHardwareIO && LI->isVolatile())
+            WL.VolatileLoads.push_back(LI);
+        } else if (StoreInst *SI = dyn_cast<StoreInst>(&I)) {
+          if (HardenMemory && !skipCandidate(SI))
+            WL.Stores.push_back(SI);
+        } else if (BinaryOperator *BO = dyn_cast<BinaryOperator>(&I)) {
+          if (HardenArithmetic && !skipCandidate(BO))
+            WL.Arithmetic.push_back(BO);
+        } else if (CallInst *CI = dyn_cast<CallInst>(&I)) {
+          if (HardenCFI && !CI->getCalledFunction())
+            WL.IndirectCalls.push_back(CI);
+        } else if (AllocaInst *AI = dyn_cast<AllocaInst>(&I)) {
+          if (HardenDataRedundancy)
+            WL.Variables.push_back(AI);
+        } else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+          if (HardenMemorySafety)
+            WL.MemoryAccesses.push_back(GEP);
+        } else if (LandingPadInst *LP = dyn_cast<LandingPadInst>(&I)) {
+          if (HardenExceptionPaths)
+            WL.ExceptionPaths.push_back(LP);
+        }
+      }
+    }
+  }
   
+  // ===== CODE-SIZE BUDGET =====
+
+  // Parse -fi-harden-size-budget for a function of BaseSize instructions.
+  // Returns UINT_MAX when no budget is configured.
+  unsigned computeSizeBudget(unsigned BaseSize) {
+    StringRef Spec = StringRef(SizeBudget).trim();
+    if (Spec.empty())
+      return UINT_MAX;
+
+    bool IsPercent = Spec.consume_back("%");
+    unsigned Amount;
+    if (Spec.trim().getAsInteger(10, Amount)) {
+      errs() << "  [WARNING] Ignoring malformed -fi-harden-size-budget '"
+             << SizeBudget << "'\n";
+      return UINT_MAX;
+    }
+
+    if (IsPercent)
+      return (unsigned)((uint64_t)BaseSize * Amount / 100);
+    return Amount;
+  }
+
+  // Upper bound on the instructions each strategy inserts for one candidate.
+  // Kept in sync with the harden* implementations above and below.
+  unsigned estimateHardeningCost(CandidateKind Kind, Instruction *I) {
+    // A diverse form over a clone: up to five instructions and an opaque
+    // copy with a zext and trunc around it
+    unsigned DiverseExtra = Diverse ? 7 : 0;
+    switch (Kind) {
+    case CandidateKind::Entry: {
+      unsigned Returns = 0;
+      for (BasicBlock &BB : *I->getFunction())
+        if (isa<ReturnInst>(BB.getTerminator()))
+          Returns++;
+      // alloca + protect call, then per return: verify, icmp, br, log, unreachable
+      return 2 + Returns * 5;
+    }
+    case CandidateKind::Branch:
+      return 5 + DiverseExtra;  // cond.dup, 2x zext, verify call, and
+    case CandidateKind::Load:
+      if (LoadAddress) {
+        // Verify call and the cloned chain: each GEP, and an opaque copy
+        // (up to zext, asm, trunc) of each variable index or of the base
+        unsigned Cost = 1 + 3;
+        Value *Addr = cast<LoadInst>(I)->getPointerOperand();
+        for (unsigned Depth = 0; Depth < 4; ++Depth) {
+          auto *GEP = dyn_cast<GetElementPtrInst>(Addr);
+          if (!GEP)
+            break;
+          Cost += 1 + 3 * count_if(GEP->indices(),
+                                   [](Value *Idx) { return !isa<Constant>(Idx); });
+          Addr = GEP->getPointerOperand();
+        }
+        return Cost;
+      }
+      return HardenLevel >= 3 ? 4 : 2;  // load.dup(s) + verify call(s)
+    case CandidateKind::Store:
+      // Count GEP, load and compare, the full-log flush and its branches,
+      // the masked slot, three entry GEPs and stores, and the count update
+      if (DeferredStores && !SelfTest)
+        return HardenLevel >= 2 ? 18 : 17;
+      return HardenLevel >= 2 ? 3 : 2;  // read-back, verify, checksum update
+    case CandidateKind::Arithmetic:
+      return 2;
+    case CandidateKind::IndirectCall:
+      return EnableFaultLogging ? 2 : 1;
+    case CandidateKind::CriticalVariable: {
+      unsigned Stores = 0;
+      for (User *U : I->users())
+        if (isa<StoreInst>(U))
+          Stores++;
+      if (FrameChecksum)  // old value, xor, fold, checksum update
+        return 1 + Stores * 6;
+      return 1 + Stores;
+    }
+    case CandidateKind::BoundsCheck:
+      return 6;  // check call, icmp, br x2, log, unreachable
+    case CandidateKind::ExceptionPath:
+    case CandidateKind::VolatileLoad:
+    case CandidateKind::Timing:
+      return 1;
+    case CandidateKind::Phi:
+      return 2;
+    case CandidateKind::TMR:
+      return 11 + 2 * DiverseExtra;  // 2 clones, 3 compares, 2 ors, br x2, log, unreachable
+    case CandidateKind::Temporary:
+      return 4 + DiverseExtra;  // clone, optional 2x zext, verify call
+    case CandidateKind::OutputPoint:  // sync call; commit call and buffer size
+      return (Async ? 1 : 0) + (OutputCommit ? 4 : 0);
+    case CandidateKind::StoreLog: {
+      // alloca, count and its reset, and a flush at every sync point; with
+      // nothing logged yet, every original write counts as one
+      unsigned Flushes = 0;
+      for (Instruction &SyncPoint : instructions(*I->getFunction()))
+        Flushes += isStoreLogSyncPoint(SyncPoint);
+      return 3 + Flushes;
+    }
+    case CandidateKind::LoopTripCount: {
+      // Counter phi and increment, then per checked exit the expanded count
+      // and its zext and, on each exit edge, the verify call and the split's
+      // branch
+      Loop *L = BudgetLoops->getLoopFor(I->getParent());
+      SCEVExpander Expander(*BudgetSE, I->getModule()->getDataLayout(), "loop.trip");
+      SmallVector<BasicBlock*, 4> Exiting;
+      L->getExitingBlocks(Exiting);
+      unsigned Cost = 2;
+      for (BasicBlock *E : Exiting)
+        if (const SCEV *Count = getCheckableExitCount(L, E, *BudgetSE, Expander)) {
+          Cost += Count->getExpressionSize() + 1;
+          for (BasicBlock *Succ : successors(E))
+            if (!L->contains(Succ))
+              Cost += 2;
+        }
+      return Cost;
+    }
+    }
+    return 0;
+  }
+
+  // Relative protection value; the budget is spent on the highest values first
+  unsigned estimateHardeningValue(CandidateKind Kind, Instruction *I) {
+    unsigned Value = 0;
+    switch (Kind) {
+    case CandidateKind::Entry:            return 10; // guards every return
+    case CandidateKind::OutputPoint:      return 9;  // reports every check before it
+    case CandidateKind::StoreLog:         return 9;  // needed before any store is logged
+    case CandidateKind::Branch:           Value = 8; break;
+    case CandidateKind::LoopTripCount:    Value = 8; break;
+    case CandidateKind::IndirectCall:     Value = 7; break;
+    case CandidateKind::Store:            Value = 6; break;
+    case CandidateKind::CriticalVariable: Value = 5; break;
+    case CandidateKind::Load:             Value = 4; break;
+    case CandidateKind::TMR:              Value = 4; break;
+    case CandidateKind::Arithmetic:       Value = 3; break;
+    case CandidateKind::Phi:              Value = 3; break;
+    case CandidateKind::BoundsCheck:      Value = 2; break;
+    case CandidateKind::VolatileLoad:     Value = 2; break;
+    case CandidateKind::ExceptionPath:    Value = 1; break;
+    case CandidateKind::Timing:           Value = 1; break;
+    case CandidateKind::Temporary:        Value = 1; break;
+    }
+    if (isInCriticalPath(I))
+      Value += 4;
+    if (Vulnerability)
+      Value += Vulnerability->impact(I);
+    return Value;
+  }
+
+  // Greedily select the most valuable candidates that fit in Budget
+  unsigned selectWithinBudget(std::vector<HardeningCandidate> &Candidates,
+                              unsigned Budget) {
+    std::stable_sort(Candidates.begin(), Candidates.end(),
+                     [](const HardeningCandidate &A, const HardeningCandidate &B) {
+                       if (A.Value != B.Value)
+                         return A.Value > B.Value;
+                       return A.Cost < B.Cost;
+                     });
+
+    unsigned Spent = 0;
+    BudgetSelection.clear();
+    for (const HardeningCandidate &C : Candidates) {
+      if (C.Cost > Budget - Spent)
+        continue;
+      Spent += C.Cost;
+      BudgetSelection.insert({C.Inst, static_cast<unsigned>(C.Kind)});
+    }
+    return Spent;
+  }
+
+  // Every hardening opportunity in the unmodified function, with its cost
+  // and value, including the level 2+ LLFI protections
+  std::vector<HardeningCandidate> collectBudgetCandidates(Function &F,
+                                                          HardeningWorklist &WL) {
+    std::vector<HardeningCandidate> Candidates;
+    auto Add = [&](CandidateKind Kind, Instruction *I) {
+      Candidates.push_back({Kind, I, estimateHardeningCost(Kind, I),
+                            estimateHardeningValue(Kind, I)});
+    };
+    // Mirrors the level 0 early-outs of the basic strategies
+    auto Eligible = [&](Instruction *I) {
+      return HardenLevel > 0 || isInCriticalPath(I);
+    };
+    
+    if (HardenStack && HardenLevel > 0)
+      Add(CandidateKind::Entry, &*F.getEntryBlock().getFirstInsertionPt());
+    if (DeferredStores && !SelfTest)
+      Add(CandidateKind::StoreLog, &*F.getEntryBlock().getFirstInsertionPt());
+    
+    if (HardenTiming && HardenLevel >= 2)
+      for (BasicBlock &BB : F)
+        if (auto *BI = dyn_cast<BranchInst>(BB.getTerminator()))
+          if (BI->isConditional())
+            Add(CandidateKind::Timing, BI);
+    
+    for (BranchInst *BI : WL.Branches)
+      if (Eligible(BI))
+        Add(CandidateKind::Branch, BI);
+    for (LoadInst *LI : WL.Loads)
+      if (Eligible(LI))
+        Add(CandidateKind::Load, LI);
+    for (StoreInst *SI : WL.Stores)
+      if (Eligible(SI))
+        Add(CandidateKind::Store, SI);
+    if (HardenLevel >= 2)
+      for (BinaryOperator *BO : WL.Arithmetic)
+        Add(CandidateKind::Arithmetic, BO);
+    for (CallInst *CI : WL.IndirectCalls)
+      if (Eligible(CI))
+        Add(CandidateKind::IndirectCall, CI);
+    if (HardenLevel >= 2)
+      for (AllocaInst *AI : WL.Variables)
+        Add(CandidateKind::CriticalVariable, AI);
+    for (GetElementPtrInst *GEP : WL.MemoryAccesses)
+      Add(CandidateKind::BoundsCheck, GEP);
+    for (LandingPadInst *LP : WL.ExceptionPaths)
+      Add(CandidateKind::ExceptionPath, LP);
+    for (LoadInst *LI : WL.VolatileLoads)
+      Add(CandidateKind::VolatileLoad, LI);
+    if (Async || OutputCommit)
+      for (Instruction &I : instructions(F))
+        if (auto *CI = dyn_cast<CallInst>(&I))
+          if (isOutputCall(CI))
+            Add(CandidateKind::OutputPoint, CI);
+    if (LoopTripCount)
+      for (Loop *L : BudgetLoops->getLoopsInPreorder())
+        if (L->getLoopPreheader())
+          Add(CandidateKind::LoopTripCount, L->getHeader()->getTerminator());
+    
+    if (HardenLevel >= 2) {
+      std::vector<PHINode*> PhiNodes;
+      std::vector<BinaryOperator*> CriticalArithmetic;
+      std::vector<Instruction*> TemporaryValues;
+      collectLLFICandidates(F, PhiNodes, CriticalArithmetic, TemporaryValues);
+      
+      for (PHINode *Phi : PhiNodes)
+        Add(CandidateKind::Phi, Phi);
+      if (HardenLevel >= 3)
+        for (BinaryOperator *BO : CriticalArithmetic)
+          Add(CandidateKind::TMR, BO);
+      unsigned count = 0;
+      for (Instruction *I : TemporaryValues)
+        if (HardenLevel >= 3 || count++ % 2 == 0)
+          Add(CandidateKind::Temporary, I);
+    }
+    
+    return Candidates;
+  }
+  
+  // True if the candidate may be hardened under the active budget
+  bool withinBudget(CandidateKind Kind, Instruction *I) {
+    if (!BudgetActive ||
+        BudgetSelection.count({I, static_cast<unsigned>(Kind)}))
+      return true;
+    Stats.CandidatesOverBudget++;
+    return false;
+  }
+
 public:
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
     // Skip declarations
@@ -780,100 +2320,126 @@ public:
     
     Module *M = F.getParent();
     initializeRuntimeFunctions(*M);
+    if (LoadAddress)
+      collectReReadObjects(F);
+    StoreLog = nullptr;
+    FrameChecksumSlot = nullptr;
+    FrameChecksumVars.clear();
+    FrameChecksumPoints.clear();
+    LoggedStores.clear();
+    BookkeepingCode.clear();
+    OriginalWrites.clear();
+    if (DeferredStores)
+      for (Instruction &I : instructions(F))
+        if (I.mayWriteToMemory() && !isa<CallBase>(I))
+          OriginalWrites.insert(&I);
+    
+    // Computed on the unmodified function; shared with fi-harden through the
+    // analysis manager's cache
+    Vulnerability = &FAM.getResult<FIVulnerabilityAnalysis>(F);
+    SDCCutoff = computeSDCCutoff(F);
+    
+    unsigned SizeBefore = F.getInstructionCount();
+    unsigned Budget = computeSizeBudget(SizeBefore);
+    BudgetActive = Budget != UINT_MAX;
+    
+    // Collect instructions to harden (avoid iterator invalidation). Under a
+    // size budget the worklist is taken from the unmodified function so that
+    // candidates are ranked before any strategy has grown it.
+    HardeningWorklist WL;
+    if (BudgetActive) {
+      collectHardeningWorklist(F, WL);
+      if (LoopTripCount) {
+        BudgetLoops = &FAM.getResult<LoopAnalysis>(F);
+        BudgetSE = &FAM.getResult<ScalarEvolutionAnalysis>(F);
+      }
+      std::vector<HardeningCandidate> Candidates = collectBudgetCandidates(F, WL);
+      unsigned Planned = selectWithinBudget(Candidates, Budget);
+      errs() << "  Size budget: " << Budget << " instructions, "
+             << Planned << " planned for " << BudgetSelection.size()
+             << " of " << Candidates.size() << " candidates\n";
+    }
+    
+    // Stores are logged only if the log and its flushes fit the budget;
+    // otherwise they are read back
+    LogStores = DeferredStores && !SelfTest &&
+                withinBudget(CandidateKind::StoreLog, &*F.getEntryBlock().getFirstInsertionPt());
     
     // Apply function-level hardening first
-    if (HardenStack)
+    if (HardenStack &&
+        withinBudget(CandidateKind::Entry, &*F.getEntryBlock().getFirstInsertionPt()))
       hardenFunctionEntry(F);
     
-    // Collect instructions to harden (avoid iterator invalidation)
-    std::vector<BranchInst*> BranchesToHarden;
-    std::vector<LoadInst*> LoadsToHarden;
-    std::vector<StoreInst*> StoresToHarden;
-    std::vector<BinaryOperator*> ArithmeticToHarden;
-    std::vector<CallInst*> IndirectCallsToHarden;
-    std::vector<AllocaInst*> VariablesToProtect;
-    std::vector<GetElementPtrInst*> MemoryAccessesToCheck;
-    std::vector<LandingPadInst*> ExceptionPathsToHarden;
-    std::vector<LoadInst*> VolatileLoadsToValidate;
-    
-    for (BasicBlock &BB : F) {
-      // Apply timing mitigation to basic block if needed
-      if (HardenTiming)
+    // Apply timing mitigation to basic blocks if needed
+    if (HardenTiming)
+      for (BasicBlock &BB : F)
         addTimingMitigation(BB, F);
-      
-      for (Instruction &I : BB) {
-        if (shouldSkipInstruction(I))
-          continue;
-        
-        if (BranchInst *BI = dyn_cast<BranchInst>(&I)) {
-          if (HardenBranches && BI->isConditional() && isa<ICmpInst>(BI->getCondition()))
-            BranchesToHarden.push_back(BI);
-        } else if (LoadInst *LI = dyn_cast<LoadInst>(&I)) {
-          if (HardenMemory)
-            LoadsToHarden.push_back(LI);
-          if (HardenHardwareIO && LI->isVolatile())
-            VolatileLoadsToValidate.push_back(LI);
-        } else if (StoreInst *SI = dyn_cast<StoreInst>(&I)) {
-          if (HardenMemory)
-            StoresToHarden.push_back(SI);
-        } else if (BinaryOperator *BO = dyn_cast<BinaryOperator>(&I)) {
-          if (HardenArithmetic)
-            ArithmeticToHarden.push_back(BO);
-        } else if (CallInst *CI = dyn_cast<CallInst>(&I)) {
-          if (HardenCFI && !CI->getCalledFunction())
-            IndirectCallsToHarden.push_back(CI);
-        } else if (AllocaInst *AI = dyn_cast<AllocaInst>(&I)) {
-          if (HardenDataRedundancy)
-            VariablesToProtect.push_back(AI);
-        } else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&I)) {
-          if (HardenMemorySafety)
-            MemoryAccessesToCheck.push_back(GEP);
-        } else if (LandingPadInst *LP = dyn_cast<LandingPadInst>(&I)) {
-          if (HardenExceptionPaths)
-            ExceptionPathsToHarden.push_back(LP);
-        }
-      }
-    }
+    
+    if (!BudgetActive)
+      collectHardeningWorklist(F, WL);
+    
+    if (LoopTripCount)
+      hardenLoopTripCounts(F, FAM);
     
     // Apply basic transformations
-    for (BranchInst *BI : BranchesToHarden)
-      hardenBranch(BI, F);
+    for (BranchInst *BI : WL.Branches)
+      if (withinBudget(CandidateKind::Branch, BI))
+        hardenBranch(BI, F);
     
-    for (LoadInst *LI : LoadsToHarden)
-      hardenLoad(LI, F);
+    for (LoadInst *LI : WL.Loads)
+      if (withinBudget(CandidateKind::Load, LI))
+        hardenLoad(LI, F);
     
-    for (StoreInst *SI : StoresToHarden)
-      hardenStore(SI, F);
+    for (StoreInst *SI : WL.Stores)
+      if (withinBudget(CandidateKind::Store, SI))
+        hardenStore(SI, F);
     
-    for (BinaryOperator *BO : ArithmeticToHarden)
-      hardenArithmetic(BO, F);
+    for (BinaryOperator *BO : WL.Arithmetic)
+      if (withinBudget(CandidateKind::Arithmetic, BO))
+        hardenArithmetic(BO, F);
     
     // Apply advanced transformations
-    for (CallInst *CI : IndirectCallsToHarden)
-      hardenIndirectCall(CI, F);
+    for (CallInst *CI : WL.IndirectCalls)
+      if (withinBudget(CandidateKind::IndirectCall, CI))
+        hardenIndirectCall(CI, F);
     
-    for (AllocaInst *AI : VariablesToProtect)
-      hardenCriticalVariable(AI, F);
+    for (AllocaInst *AI : WL.Variables)
+      if (withinBudget(CandidateKind::CriticalVariable, AI))
+        hardenCriticalVariable(AI, F);
+    if (!FrameChecksumVars.empty())
+      insertFrameChecksumChecks(F);
     
-    for (GetElementPtrInst *GEP : MemoryAccessesToCheck)
-      hardenMemoryAccess(GEP, F);
+    for (GetElementPtrInst *GEP : WL.MemoryAccesses)
+      if (withinBudget(CandidateKind::BoundsCheck, GEP))
+        hardenMemoryAccess(GEP, F);
     
-    for (LandingPadInst *LP : ExceptionPathsToHarden)
-      hardenExceptionPath(LP, F);
+    for (LandingPadInst *LP : WL.ExceptionPaths)
+      if (withinBudget(CandidateKind::ExceptionPath, LP))
+        hardenExceptionPath(LP, F);
     
-    for (LoadInst *LI : VolatileLoadsToValidate)
-      hardenVolatileLoad(LI, F);
+    for (LoadInst *LI : WL.VolatileLoads)
+      if (withinBudget(CandidateKind::VolatileLoad, LI))
+        hardenVolatileLoad(LI, F);
     
     // ===== NEW: Apply comprehensive LLFI protection (Phase 1) =====
     if (HardenLevel >= 2) {
       applyComprehensiveLLFIProtection(F);
     }
     
-    unsigned totalTransforms = BranchesToHarden.size() + LoadsToHarden.size() + 
-                               StoresToHarden.size() + ArithmeticToHarden.size() +
-                               IndirectCallsToHarden.size() + VariablesToProtect.size() +
-                               MemoryAccessesToCheck.size() + ExceptionPathsToHarden.size() +
-                               VolatileLoadsToValidate.size();
+    if (Async || OutputCommit)
+      insertOutputPoints(F);
+    
+    if (StoreLog)
+      insertStoreLogFlushes(F);
+    
+    unsigned totalTransforms = WL.size();
+    
+    unsigned SizeAfter = F.getInstructionCount();
+    Stats.InstructionsBefore += SizeBefore;
+    Stats.InstructionsAfter += SizeAfter;
+    if (BudgetActive)
+      errs() << "  [Budget] Size " << SizeBefore << " -> " << SizeAfter
+             << " instructions (+" << (SizeAfter - SizeBefore) << ")\n";
     
     if (totalTransforms > 0) {
       errs() << "  [Transform] Applied " << totalTransforms << " transformations\n";
@@ -892,6 +2458,8 @@ public:
       }
     }
     
+    Vulnerability = nullptr;
+    
     // Indicate that analyses are invalidated
     return PreservedAnalyses::none();
   }
@@ -920,10 +2488,30 @@ public:
     errs() << "========================================\n";
     
     // Process each function
+    FunctionAnalysisManager &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
     for (Function &F : M) {
       if (!F.isDeclaration()) {
-        FunctionAnalysisManager DummyFAM;
-        run(F, DummyFAM);
+        PreservedAnalyses PA = run(F, FAM);
+        FAM.invalidate(F, PA);
+      }
+    }
+    
+    // Inlined fast paths would leave fi-selftest-hooks no verify calls to
+    // find the checks by
+    if (!InlineRuntime.empty() && !SelfTest)
+      linkRuntimeFastPaths(M);
+    
+    if (!SiteTable.empty()) {
+      std::error_code EC;
+      raw_fd_ostream OS(SiteTable, EC, sys::fs::OF_Text);
+      if (EC) {
+        errs() << "  [ERROR] Cannot write site table '" << SiteTable
+               << "': " << EC.message() << "\n";
+      } else {
+        writeSiteTable(OS);
+        errs() << "  [SiteTable] " << CheckSites.size()
+               << " check sites written to " << SiteTable << "\n";
       }
     }
     
@@ -960,21 +2548,61 @@ public:
     Builder.SetInsertPoint(BO->getNextNode());
     
     // Create two redundant copies
-    Value *Clone1 = Builder.CreateBinOp(Opcode, Op0, Op1, BO->getName() + ".tmr1");
-    Value *Clone2 = Builder.CreateBinOp(Opcode, Op0, Op1, BO->getName() + ".tmr2");
+    Value *Clone1 = Diverse ? createDiverseShadow(Builder, BO, 0, BO->getName() + ".tmr1")
+                            : nullptr;
+    Value *Clone2 = Diverse ? createDiverseShadow(Builder, BO, 1, BO->getName() + ".tmr2")
+                            : nullptr;
+    // Without a diverse form, each clone still takes a different operand
+    // through an opaque copy so that neither is merged
+    if (!Clone1)
+      Clone1 = Builder.CreateBinOp(Opcode, Diverse ? createOpaqueCopy(Builder, Op0) : Op0,
+                                   Op1, BO->getName() + ".tmr1");
+    if (!Clone2)
+      Clone2 = Builder.CreateBinOp(Opcode, Op0,
+                                   Diverse ? createOpaqueCopy(Builder, Op1) : Op1,
+                                   BO->getName() + ".tmr2");
     
     Stats.InstructionsDuplicated += 2;
     
+    // Self-test: both clones are corrupted, with different patterns, so the
+    // vote itself must fail (a single bad clone is outvoted by design). An i1
+    // has no third value, so two corrupted clones would agree and outvote BO.
+    auto *Shadow1 = dyn_cast<Instruction>(Clone1);
+    auto *Shadow2 = dyn_cast<Instruction>(Clone2);
+    bool SelfTestVote = SelfTest && Shadow1 && Shadow2 &&
+                        isSelfTestable(BO->getType()) && !BO->getType()->isIntegerTy(1);
+    if (SelfTestVote) {
+      unsigned Site = addSelfTestSite(F, BO, "tmr", BO->getType());
+      tagSelfTestShadow(Shadow1, Site, 0);
+      tagSelfTestShadow(Shadow2, Site, 1);
+    }
+    
     // Majority voting: 2 out of 3 must match
     Value *Match12 = Builder.CreateICmpEQ(BO, Clone1, "tmr.match12");
     Value *Match13 = Builder.CreateICmpEQ(BO, Clone2, "tmr.match13");
     Value *Match23 = Builder.CreateICmpEQ(Clone1, Clone2, "tmr.match23");
+    if (SelfTestVote)
+      for (Value *Match : {Match12, Match13, Match23})
+        if (auto *Vote = dyn_cast<Instruction>(Match))
+          Vote->setMetadata("fi.selftest.vote", MDNode::get(F.getContext(), {}));
     
     // At least 2 must match
     Value *TwoMatch = Builder.CreateOr(
         Builder.CreateOr(Match12, Match13),
         Match23, "tmr.valid");
     
+    // Output commit: a failed vote only marks the sticky word; no block split
+    if (OutputCommit) {
+      Value *Location = createLocationString(Builder, BO, "tmr");
+      Builder.CreateCall(VerifyBranchFunc,
+                         {Builder.CreateZExt(TwoMatch, Builder.getInt32Ty()),
+                          Builder.getInt32(1), Location});
+      Stats.ArithmeticHardened++;
+      Stats.VerificationCallsAdded++;
+      Stats.TMRApplications++;
+      return;
+    }
+    
     // Create error block
     BasicBlock *OrigBB = BO->getParent();
     BasicBlock::iterator SplitPoint = Builder.GetInsertPoint();
@@ -993,7 +2621,8 @@ public:
     Builder.SetInsertPoint(ErrorBB);
     Value *ErrorMsg = Builder.CreateGlobalStringPtr(
         "TMR voting failed in " + F.getName().str());
-    Builder.CreateCall(LogFaultFunc, {ErrorMsg, Builder.getInt32(2)}); // Severity 2
+    Builder.CreateCall(LogFaultFunc, {ErrorMsg, Builder.getInt32(2)}) // Severity 2
+        ->addFnAttr(Attribute::Cold);
     Builder.CreateUnreachable();
     
     // Use the original value if voting passed (it's guaranteed to match at least one clone)
@@ -1014,7 +2643,6 @@ public:
     errs() << "  [PHI] Verifying phi node in function '" << F.getName() << "'\n";
     
     IRBuilder<> Builder(Phi->getParent()->getFirstNonPHI());
-    Module *M = F.getParent();
     
     // Create a redundant phi node
     PHINode *PhiDup = Builder.CreatePHI(Phi->getType(), 
@@ -1030,18 +2658,21 @@ public:
     Stats.InstructionsDuplicated++;
     
     // Verify both phi nodes produce the same value
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), "phi");
+    Value *Location = createLocationString(Builder, Phi, "phi");
     
     Type *PhiType = Phi->getType();
+    Value *PhiCheck = PhiDup;
+    if (PhiType->isIntegerTy(32) || PhiType->isIntegerTy(64) || PhiType->isPointerTy())
+      PhiCheck = selfTestShadow(PhiDup, F, Phi, "phi.dup");
     if (PhiType->isIntegerTy(32)) {
-      Builder.CreateCall(VerifyInt32Func, {Phi, PhiDup, Location});
+      Builder.CreateCall(VerifyInt32Func, {Phi, PhiCheck, Location});
       Stats.VerificationCallsAdded++;
     } else if (PhiType->isIntegerTy(64)) {
-      Builder.CreateCall(VerifyInt64Func, {Phi, PhiDup, Location});
+      Builder.CreateCall(VerifyInt64Func, {Phi, PhiCheck, Location});
       Stats.VerificationCallsAdded++;
     } else if (PhiType->isPointerTy()) {
       Value *Ptr1 = Builder.CreateBitCast(Phi, PointerType::getUnqual(Builder.getInt8Ty()));
-      Value *Ptr2 = Builder.CreateBitCast(PhiDup, PointerType::getUnqual(Builder.getInt8Ty()));
+      Value *Ptr2 = Builder.CreateBitCast(PhiCheck, PointerType::getUnqual(Builder.getInt8Ty()));
       Builder.CreateCall(VerifyPointerFunc, {Ptr1, Ptr2, Location});
       Stats.VerificationCallsAdded++;
     }
@@ -1069,37 +2700,41 @@ public:
       return;
     
     IRBuilder<> Builder(I->getNextNode());
-    Module *M = F.getParent();
     
     errs() << "  [TEMP] Protecting temporary value: " << I->getOpcodeName() << "\n";
     
     // Clone the instruction for redundancy
-    Instruction *Clone = I->clone();
-    Clone->setName(I->getName() + ".temp_dup");
-    Builder.Insert(Clone);
+    Value *Clone = Diverse ? createDiverseShadow(Builder, I, 0, I->getName() + ".temp_dup")
+                           : nullptr;
+    if (!Clone) {
+      Instruction *Exact = I->clone();
+      if (Diverse && Exact->getNumOperands())  // No diverse form: keep it separate
+        Exact->setOperand(0, createOpaqueCopy(Builder, I->getOperand(0)));
+      Clone = Builder.Insert(Exact, I->getName() + ".temp_dup");
+    }
     
     Stats.InstructionsDuplicated++;
     
     // Verify both produce the same result
-    Value *Location = createLocationString(Builder, *M, F.getName().str(), 
-                                          std::string("temp:") + I->getOpcodeName());
+    Value *Location = createLocationString(Builder, I, std::string("temp:") + I->getOpcodeName());
     
     Type *InstType = I->getType();
+    Value *CloneCheck = selfTestShadow(Clone, F, I, "temp_dup");
     if (InstType->isIntegerTy(32)) {
-      Builder.CreateCall(VerifyInt32Func, {I, Clone, Location});
+      Builder.CreateCall(VerifyInt32Func, {I, CloneCheck, Location});
       Stats.VerificationCallsAdded++;
     } else if (InstType->isIntegerTy(64)) {
-      Builder.CreateCall(VerifyInt64Func, {I, Clone, Location});
+      Builder.CreateCall(VerifyInt64Func, {I, CloneCheck, Location});
       Stats.VerificationCallsAdded++;
     } else if (InstType->isIntegerTy()) {
       // For other integer types, extend to 32-bit
       Value *I32_1 = Builder.CreateZExtOrTrunc(I, Builder.getInt32Ty());
-      Value *I32_2 = Builder.CreateZExtOrTrunc(Clone, Builder.getInt32Ty());
+      Value *I32_2 = Builder.CreateZExtOrTrunc(CloneCheck, Builder.getInt32Ty());
       Builder.CreateCall(VerifyInt32Func, {I32_1, I32_2, Location});
       Stats.VerificationCallsAdded++;
     } else if (InstType->isPointerTy()) {
       Value *Ptr1 = Builder.CreateBitCast(I, PointerType::getUnqual(Builder.getInt8Ty()));
-      Value *Ptr2 = Builder.CreateBitCast(Clone, PointerType::getUnqual(Builder.getInt8Ty()));
+      Value *Ptr2 = Builder.CreateBitCast(CloneCheck, PointerType::getUnqual(Builder.getInt8Ty()));
       Builder.CreateCall(VerifyPointerFunc, {Ptr1, Ptr2, Location});
       Stats.VerificationCallsAdded++;
     }
@@ -1107,21 +2742,18 @@ public:
     Stats.TemporariesProtected++;
   }
   
-  // NEW METHOD 4: Comprehensive Function Coverage (applies all LLFI protections)
-  void applyComprehensiveLLFIProtection(Function &F) {
-    if (F.isDeclaration()) return;
-    
-    errs() << "\n[LLFI] Applying comprehensive LLFI protection to '" 
-           << F.getName() << "'\n";
-    
-    std::vector<PHINode*> PhiNodes;
-    std::vector<BinaryOperator*> CriticalArithmetic;
-    std::vector<Instruction*> TemporaryValues;
-    
-    // Collect instructions for protection
+  // Collect instructions for the LLFI coverage protections
+  void collectLLFICandidates(Function &F, std::vector<PHINode*> &PhiNodes,
+                             std::vector<BinaryOperator*> &CriticalArithmetic,
+                             std::vector<Instruction*> &TemporaryValues) {
     for (BasicBlock &BB : F) {
       for (Instruction &I : BB) {
-        if (shouldSkipInstruction(I))
+        bool IsTemporary = !I.use_empty() && !isa<PHINode>(&I) &&
+                           !isa<AllocaInst>(&I) && !isa<LoadInst>(&I) &&
+                           !isa<StoreInst>(&I) && !isa<CallInst>(&I);
+        if (!isa<PHINode>(&I) && !isa<BinaryOperator>(&I) && !IsTemporary)
+          continue;
+        if (shouldSkipInstruction(I) || skipCandidate(&I))
           continue;
         
         // Collect phi nodes
@@ -1143,13 +2775,24 @@ public:
         }
         
         // Collect temporary values (short-lived intermediates)
-        if (!I.use_empty() && !isa<PHINode>(&I) && 
-            !isa<AllocaInst>(&I) && !isa<LoadInst>(&I) &&
-            !isa<StoreInst>(&I) && !isa<CallInst>(&I)) {
+        if (IsTemporary) {
           TemporaryValues.push_back(&I);
         }
       }
     }
+  }
+  
+  // NEW METHOD 4: Comprehensive Function Coverage (applies all LLFI protections)
+  void applyComprehensiveLLFIProtection(Function &F) {
+    if (F.isDeclaration()) return;
+    
+    errs() << "\n[LLFI] Applying comprehensive LLFI protection to '" 
+           << F.getName() << "'\n";
+    
+    std::vector<PHINode*> PhiNodes;
+    std::vector<BinaryOperator*> CriticalArithmetic;
+    std::vector<Instruction*> TemporaryValues;
+    collectLLFICandidates(F, PhiNodes, CriticalArithmetic, TemporaryValues);
     
     // Apply protections
     errs() << "  [LLFI] Found " << PhiNodes.size() << " phi nodes\n";
@@ -1158,13 +2801,15 @@ public:
     
     // Phase 1: Phi node verification
     for (PHINode *Phi : PhiNodes) {
-      verifyPhiNode(Phi, F);
+      if (withinBudget(CandidateKind::Phi, Phi))
+        verifyPhiNode(Phi, F);
     }
     
     // Phase 2: TMR for critical arithmetic
     if (HardenLevel >= 3) {
       for (BinaryOperator *BO : CriticalArithmetic) {
-        applyTMRToArithmetic(BO, F);
+        if (withinBudget(CandidateKind::TMR, BO))
+          applyTMRToArithmetic(BO, F);
       }
     }
     
@@ -1174,7 +2819,11 @@ public:
       unsigned protectionRate = HardenLevel >= 3 ? 100 : 50; // 50% or 100%
       unsigned count = 0;
       for (Instruction *I : TemporaryValues) {
-        if (count++ % (100 / protectionRate) == 0) {
+        // Under a budget the subset was already chosen on the original IR
+        if (BudgetActive) {
+          if (withinBudget(CandidateKind::Temporary, I))
+            protectTemporaryValue(I, F);
+        } else if (count++ % (100 / protectionRate) == 0) {
           protectTemporaryValue(I, F);
         }
       }
@@ -1186,6 +2835,145 @@ public:
   }
 };
 
+// ===== SELF-TEST HOOKS =====
+//
+// Inserts fi_selftest_shadow on the shadows -fi-harden-self-test tagged, at
+// the end of the optimization pipeline, so that CSE and InstCombine treat a
+// self-test build's shadows exactly as a normal build's. A site left
+// without a tagged shadow that still feeds a check was merged away or
+// folded into its master and is reported as optimized away, in the log
+// and in the self-test map.
+class FISelfTestHooks : public PassInfoMixin<FISelfTestHooks> {
+  // Operand 0 or 1 of a verify call that compares two different values
+  static bool isCheckOperand(Use &U) {
+    auto *CI = dyn_cast<CallInst>(U.getUser());
+    Function *Callee = CI ? CI->getCalledFunction() : nullptr;
+    if (!Callee || !Callee->getName().starts_with("fi_") ||
+        !Callee->getName().contains("verify_") || CI->arg_size() != 3 ||
+        U.getOperandNo() > 1)
+      return false;
+    return CI->getArgOperand(0) != CI->getArgOperand(1);
+  }
+  
+  // shadow' = fi_selftest_shadow(site, shadow, width, salt); only the check
+  // sees shadow', so a corrupted shadow can never change program results
+  static Value *corruptShadow(IRBuilder<> &Builder, FunctionCallee Hook, Value *Shadow,
+                              unsigned Site, unsigned Salt) {
+    Type *Ty = Shadow->getType();
+    const DataLayout &DL = Builder.GetInsertBlock()->getModule()->getDataLayout();
+    unsigned Width = Ty->isPointerTy() ? DL.getPointerSizeInBits()
+                                       : Ty->getIntegerBitWidth();
+    Value *Raw = Ty->isPointerTy() ? Builder.CreatePtrToInt(Shadow, Builder.getInt64Ty())
+                                   : Builder.CreateZExt(Shadow, Builder.getInt64Ty());
+    Value *Corrupted = Builder.CreateCall(
+        Hook, {Builder.getInt32(Site), Raw, Builder.getInt32(Width), Builder.getInt32(Salt)});
+    return Ty->isPointerTy()
+        ? Builder.CreateIntToPtr(Corrupted, Ty, Shadow->getName() + ".st")
+        : Builder.CreateTrunc(Corrupted, Ty, Shadow->getName() + ".st");
+  }
+  
+  // Hooks Shadow's check uses: verify call operands, directly or through
+  // one cast that is not a shadow of its own, and TMR votes. False if it
+  // has none left.
+  static bool hookShadow(Instruction *Shadow, FunctionCallee Hook, unsigned Site,
+                         unsigned Salt) {
+    SmallVector<Use*, 4> Direct, ThroughCast;
+    for (Use &U : Shadow->uses()) {
+      auto *User = cast<Instruction>(U.getUser());
+      if (isCheckOperand(U) ||
+          (isa<ICmpInst>(User) && User->getMetadata("fi.selftest.vote")))
+        Direct.push_back(&U);
+      else if (isa<CastInst>(User) && !User->getMetadata("fi.selftest"))
+        for (Use &CastUse : User->uses())
+          if (isCheckOperand(CastUse))
+            ThroughCast.push_back(&CastUse);
+    }
+    if (Direct.empty() && ThroughCast.empty())
+      return false;
+    
+    BasicBlock *BB = Shadow->getParent();
+    IRBuilder<> Builder(BB, isa<PHINode>(Shadow) ? BB->getFirstInsertionPt()
+                                                 : std::next(Shadow->getIterator()));
+    Value *Corrupted = corruptShadow(Builder, Hook, Shadow, Site, Salt);
+    for (Use *U : Direct)
+      U->set(Corrupted);
+    for (Use *U : ThroughCast) {
+      Instruction *Cast = cast<Instruction>(U->get())->clone();
+      Cast->setOperand(0, Corrupted);
+      Cast->insertBefore(cast<Instruction>(U->getUser()));
+      U->set(Cast);
+    }
+    return true;
+  }
+  
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+    NamedMDNode *Sites = M.getNamedMetadata("fi.selftest.sites");
+    if (!Sites)
+      return PreservedAnalyses::all();
+    
+    // uint64_t fi_selftest_shadow(uint32_t site, uint64_t value, uint32_t width, uint32_t salt)
+    LLVMContext &Ctx = M.getContext();
+    Type *Int32Ty = Type::getInt32Ty(Ctx);
+    Type *Int64Ty = Type::getInt64Ty(Ctx);
+    FunctionCallee Hook = M.getOrInsertFunction(
+        "fi_selftest_shadow", FunctionType::get(Int64Ty, {Int32Ty, Int64Ty, Int32Ty, Int32Ty}, false));
+    FIHardeningTransform::setRuntimeAttributes(Hook, MemoryEffects::inaccessibleMemOnly(), true);
+    
+    std::vector<Instruction*> Shadows;
+    for (Function &F : M)
+      for (Instruction &I : instructions(F))
+        if (I.getMetadata("fi.selftest"))
+          Shadows.push_back(&I);
+    std::set<unsigned> Hooked;
+    for (Instruction *Shadow : Shadows) {
+      MDNode *Tag = Shadow->getMetadata("fi.selftest");
+      unsigned Site = mdconst::extract<ConstantInt>(Tag->getOperand(0))->getZExtValue();
+      unsigned Salt = mdconst::extract<ConstantInt>(Tag->getOperand(1))->getZExtValue();
+      Shadow->setMetadata("fi.selftest", nullptr);
+      if (hookShadow(Shadow, Hook, Site, Salt))
+        Hooked.insert(Site);
+    }
+    
+    // Same tab-separated format as the fi-inject site map; kind "shadow", or
+    // "shadow-optimized" for a site with nothing left to corrupt
+    std::string Map = "# site\tkind\tfunction\topcode\twidth\tlocation\n";
+    unsigned Optimized = 0;
+    for (MDNode *Site : Sites->operands()) {
+      unsigned ID = mdconst::extract<ConstantInt>(Site->getOperand(0))->getZExtValue();
+      StringRef Function = cast<MDString>(Site->getOperand(1))->getString();
+      StringRef Kind = cast<MDString>(Site->getOperand(2))->getString();
+      unsigned Width = mdconst::extract<ConstantInt>(Site->getOperand(3))->getZExtValue();
+      StringRef Location = cast<MDString>(Site->getOperand(4))->getString();
+      bool Gone = !Hooked.count(ID);
+      if (Gone) {
+        errs() << "  [SelfTest] Site " << ID << " (" << Kind << " in '" << Function
+               << "') optimized away\n";
+        Optimized++;
+      }
+      Map += (Twine(ID) + (Gone ? "\tshadow-optimized\t" : "\tshadow\t") + Function +
+              "\t" + Kind + "\t" + Twine(Width) + "\t" + Location + "\n").str();
+    }
+    errs() << "  [SelfTest] " << Hooked.size() << " of " << Sites->getNumOperands()
+           << " shadow sites hooked, " << Optimized << " optimized away\n";
+    
+    if (!SelfTestMap.empty()) {
+      std::error_code EC;
+      raw_fd_ostream OS(SelfTestMap, EC, sys::fs::OF_Text);
+      if (EC) {
+        errs() << "  [ERROR] Cannot write self-test map '" << SelfTestMap
+               << "': " << EC.message() << "\n";
+      } else {
+        OS << Map;
+        errs() << "  [SelfTest] " << Sites->getNumOperands()
+               << " shadow sites written to " << SelfTestMap << "\n";
+      }
+    }
+    Sites->eraseFromParent();
+    return PreservedAnalyses::none();
+  }
+};
+
 } // anonymous namespace
 
 // Pass registration
@@ -1194,6 +2982,11 @@ llvmGetPassPluginInfo() {
   return {
     LLVM_PLUGIN_API_VERSION, "FIHardeningTransform", LLVM_VERSION_STRING,
     [](PassBuilder &PB) {
+      PB.registerAnalysisRegistrationCallback(
+        [](FunctionAnalysisManager &FAM) {
+          FAM.registerPass([] { return FIVulnerabilityAnalysis(); });
+        });
+      
       // Register function pass
       PB.registerPipelineParsingCallback(
         [](StringRef Name, FunctionPassManager &FPM,
@@ -1213,8 +3006,24 @@ llvmGetPassPluginInfo() {
             MPM.addPass(FIHardeningTransform());
             return true;
           }
+          if (Name == "fi-selftest-hooks") {
+            MPM.addPass(FISelfTestHooks());
+            return true;
+          }
+          // Companion fault injection instrumentation (FIInjectionPass.cpp)
+          if (Name == "fi-inject") {
+            MPM.addPass(FIInjectionPass());
+            return true;
+          }
           return false;
         });
+      
+      // Self-test hooks go in after the optimizer has seen the shadows; a
+      // no-op in modules without self-test sites
+      PB.registerOptimizerLastEPCallback(
+        [](ModulePassManager &MPM, OptimizationLevel) {
+          MPM.addPass(FISelfTestHooks());
+        });
     }
   };
 }
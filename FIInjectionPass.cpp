@@ -0,0 +1,312 @@
+// FIInjectionPass.cpp
+// LLVM IR instrumentation pass for in-process fault injection
+//
+// This pass replaces the external LLFI toolchain for coverage validation.
+// It inserts calls to the FIInjectionRuntime hooks at:
+// 1. Integer and pointer instruction results (single, double-bit and
+//    byte-burst flips, or a skip that keeps the previous result)
+// 2. Stores (instruction skip)
+// 3. Conditional branches (branch inversion, or a skip that falls through)
+// and output checkpoints after calls to output library functions, which
+// let fi-campaign stop a trial as soon as its output diverges.
+//
+// Every hook carries a module-unique site ID. The runtime selects one site
+// and dynamic instance per run, so a campaign needs only one instrumented
+// build. A site map (-fi-inject-site-map) records what each ID refers to,
+// including the static SDC propensity estimate of FIVulnerabilityAnalysis
+// that fi-campaign --top-uncertain ranks sites by.
+
+#include "FIInjectionPass.h"
+#include "FIVulnerabilityAnalysis.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<bool> InjectResults(
+    "fi-inject-results",
+    cl::desc("Insert bit-flip hooks on integer and pointer results"),
+    cl::init(true));
+
+static cl::opt<bool> InjectStores(
+    "fi-inject-stores",
+    cl::desc("Insert instruction-skip hooks on stores"),
+    cl::init(true));
+
+static cl::opt<bool> InjectBranches(
+    "fi-inject-branches",
+    cl::desc("Insert branch-inversion hooks on conditional branches"),
+    cl::init(true));
+
+static cl::opt<bool> InjectCheckpoints(
+    "fi-inject-checkpoints",
+    cl::desc("Insert output checkpoints after output library calls"),
+    cl::init(true));
+
+static cl::opt<unsigned> InjectSiteBase(
+    "fi-inject-site-base",
+    cl::desc("First site ID assigned in this module (keep IDs unique across modules)"),
+    cl::init(0));
+
+static cl::opt<std::string> InjectSiteMap(
+    "fi-inject-site-map",
+    cl::desc("Write the site ID table to this file"),
+    cl::init(""));
+
+namespace {
+
+// Site kinds, as written to the site map
+enum class SiteKind { Value, Store, Branch };
+
+static const char *siteKindName(SiteKind Kind) {
+  switch (Kind) {
+  case SiteKind::Value:  return "value";
+  case SiteKind::Store:  return "store";
+  case SiteKind::Branch: return "branch";
+  }
+  return "unknown";
+}
+
+struct InjectionSite {
+  unsigned ID;
+  SiteKind Kind;
+  Instruction *Inst;
+  float SDC;  // Static SDC propensity, -1 if unknown
+};
+
+class FIInjectionInstrumenter {
+  Module &M;
+  FunctionCallee InjectValueFunc;
+  FunctionCallee InjectSkipFunc;
+  FunctionCallee InjectBranchFunc;
+  FunctionCallee CheckpointFunc;
+  std::vector<InjectionSite> Sites;
+  std::vector<CallInst *> OutputCalls;
+  unsigned NextID;
+
+public:
+  explicit FIInjectionInstrumenter(Module &M) : M(M), NextID(InjectSiteBase) {
+    LLVMContext &Ctx = M.getContext();
+    Type *Int32Ty = Type::getInt32Ty(Ctx);
+    Type *Int64Ty = Type::getInt64Ty(Ctx);
+
+    // uint64_t fi_inject_value(uint32_t site, uint64_t value, uint32_t width)
+    InjectValueFunc = M.getOrInsertFunction(
+        "fi_inject_value",
+        FunctionType::get(Int64Ty, {Int32Ty, Int64Ty, Int32Ty}, false));
+
+    // int fi_inject_skip(uint32_t site)
+    InjectSkipFunc = M.getOrInsertFunction(
+        "fi_inject_skip", FunctionType::get(Int32Ty, {Int32Ty}, false));
+
+    // int fi_inject_branch(uint32_t site, int condition)
+    InjectBranchFunc = M.getOrInsertFunction(
+        "fi_inject_branch",
+        FunctionType::get(Int32Ty, {Int32Ty, Int32Ty}, false));
+
+    // void fi_inject_checkpoint(void)
+    CheckpointFunc = M.getOrInsertFunction(
+        "fi_inject_checkpoint", FunctionType::get(Type::getVoidTy(Ctx), false));
+  }
+
+  const std::vector<InjectionSite> &getSites() const { return Sites; }
+  size_t getNumCheckpoints() const { return OutputCalls.size(); }
+
+  // Library calls whose effects reach stdout
+  static bool isOutputCall(const CallInst *CI) {
+    const Function *Callee = CI->getCalledFunction();
+    if (!Callee || !Callee->isDeclaration())
+      return false;
+    return StringSwitch<bool>(Callee->getName())
+        .Cases("printf", "puts", "putchar", "vprintf", true)
+        .Cases("fprintf", "fputs", "fputc", "putc", "fwrite", true)
+        .Cases("vfprintf", "write", "fflush", true)
+        .Default(false);
+  }
+
+  // Never instrument the runtimes themselves or calls into them
+  static bool isRuntimeFunction(const Function *F) {
+    return F && F->getName().starts_with("fi_");
+  }
+
+  bool isValueSite(Instruction &I) {
+    Type *Ty = I.getType();
+    if (!(Ty->isIntegerTy() && Ty->getIntegerBitWidth() <= 64) &&
+        !Ty->isPointerTy())
+      return false;
+    if (isa<AllocaInst>(&I) || I.isEHPad() || isa<InvokeInst>(&I) ||
+        isa<CallBrInst>(&I))
+      return false;
+    // Nothing may come between a musttail call and its ret
+    if (auto *CI = dyn_cast<CallInst>(&I))
+      if (CI->isMustTailCall())
+        return false;
+    if (auto *CB = dyn_cast<CallBase>(&I))
+      if (isRuntimeFunction(CB->getCalledFunction()))
+        return false;
+    return !I.use_empty();
+  }
+
+  void collectSites(Function &F, const FIVulnerabilityInfo &Info) {
+    for (BasicBlock &BB : F) {
+      for (Instruction &I : BB) {
+        if (isa<DbgInfoIntrinsic>(&I))
+          continue;
+        if (auto *CI = dyn_cast<CallInst>(&I))
+          if (InjectCheckpoints && isOutputCall(CI) && !CI->isMustTailCall())
+            OutputCalls.push_back(CI);
+        if (InjectResults && isValueSite(I))
+          Sites.push_back({NextID++, SiteKind::Value, &I, Info.sdcPropensity(&I)});
+        else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+          if (InjectStores)
+            Sites.push_back({NextID++, SiteKind::Store, SI, Info.sdcPropensity(SI)});
+        } else if (auto *BI = dyn_cast<BranchInst>(&I)) {
+          if (InjectBranches && BI->isConditional())
+            Sites.push_back({NextID++, SiteKind::Branch, BI, Info.sdcPropensity(BI)});
+        }
+      }
+    }
+  }
+
+  // result' = fi_inject_value(site, result, width), then rewire all users
+  void instrumentValue(const InjectionSite &Site) {
+    Instruction *I = Site.Inst;
+    BasicBlock::iterator InsertPt = isa<PHINode>(I)
+        ? I->getParent()->getFirstInsertionPt()
+        : std::next(I->getIterator());
+    IRBuilder<> Builder(I->getParent(), InsertPt);
+
+    Type *Ty = I->getType();
+    Type *Int64Ty = Builder.getInt64Ty();
+    const DataLayout &DL = M.getDataLayout();
+    unsigned Width = Ty->isPointerTy() ? DL.getPointerSizeInBits()
+                                       : Ty->getIntegerBitWidth();
+
+    Value *Raw = Ty->isPointerTy() ? Builder.CreatePtrToInt(I, Int64Ty)
+                                   : Builder.CreateZExt(I, Int64Ty);
+    Value *Injected = Builder.CreateCall(
+        InjectValueFunc,
+        {Builder.getInt32(Site.ID), Raw, Builder.getInt32(Width)});
+    Value *Result = Ty->isPointerTy()
+        ? Builder.CreateIntToPtr(Injected, Ty, I->getName() + ".fi")
+        : Builder.CreateTrunc(Injected, Ty, I->getName() + ".fi");
+
+    // For i64 the zext folds away and the call uses I itself
+    I->replaceUsesWithIf(Result, [Raw, Injected](Use &U) {
+      return U.getUser() != Raw && U.getUser() != Injected;
+    });
+  }
+
+  // if (!fi_inject_skip(site)) store
+  void instrumentStore(const InjectionSite &Site) {
+    auto *SI = cast<StoreInst>(Site.Inst);
+    IRBuilder<> Builder(SI);
+    Value *Skip = Builder.CreateCall(InjectSkipFunc, {Builder.getInt32(Site.ID)});
+    Value *DoStore = Builder.CreateICmpEQ(Skip, Builder.getInt32(0), "fi.noskip");
+    Instruction *ThenTerm = SplitBlockAndInsertIfThen(DoStore, SI, false);
+    SI->moveBefore(ThenTerm);
+  }
+
+  // cond' = fi_inject_branch(site, cond)
+  void instrumentBranch(const InjectionSite &Site) {
+    auto *BI = cast<BranchInst>(Site.Inst);
+    IRBuilder<> Builder(BI);
+    Value *Cond = Builder.CreateZExt(BI->getCondition(), Builder.getInt32Ty());
+    Value *Injected = Builder.CreateCall(InjectBranchFunc,
+                                         {Builder.getInt32(Site.ID), Cond});
+    BI->setCondition(Builder.CreateICmpNE(Injected, Builder.getInt32(0), "fi.cond"));
+  }
+
+  void instrument() {
+    for (CallInst *CI : OutputCalls)
+      IRBuilder<>(CI->getNextNode()).CreateCall(CheckpointFunc);
+    for (const InjectionSite &Site : Sites) {
+      switch (Site.Kind) {
+      case SiteKind::Value:  instrumentValue(Site);  break;
+      case SiteKind::Store:  instrumentStore(Site);  break;
+      case SiteKind::Branch: instrumentBranch(Site); break;
+      }
+    }
+  }
+
+  // One tab-separated line per site: id, kind, function, opcode, width,
+  // location, SDC propensity
+  void writeSiteMap(raw_ostream &OS) {
+    OS << "# site\tkind\tfunction\topcode\twidth\tlocation\tsdc\n";
+    const DataLayout &DL = M.getDataLayout();
+    for (const InjectionSite &Site : Sites) {
+      Instruction *I = Site.Inst;
+      Type *Ty = I->getType();
+      if (auto *SI = dyn_cast<StoreInst>(I))
+        Ty = SI->getValueOperand()->getType();
+      else if (auto *BI = dyn_cast<BranchInst>(I))
+        Ty = BI->getCondition()->getType();
+      unsigned Width = Ty->isPointerTy() ? DL.getPointerSizeInBits()
+                                         : Ty->getPrimitiveSizeInBits();
+      OS << Site.ID << "\t" << siteKindName(Site.Kind) << "\t"
+         << I->getFunction()->getName() << "\t" << I->getOpcodeName() << "\t"
+         << Width << "\t";
+      if (const DebugLoc &DLoc = I->getDebugLoc())
+        OS << DLoc->getFilename() << ":" << DLoc.getLine() << ":" << DLoc.getCol();
+      else
+        OS << "-";
+      OS << "\t" << format("%.4f", Site.SDC) << "\n";
+    }
+  }
+};
+
+} // anonymous namespace
+
+PreservedAnalyses FIInjectionPass::run(Module &M, ModuleAnalysisManager &MAM) {
+  errs() << "\n[FIInjectionPass] Instrumenting module: " << M.getName() << "\n";
+
+  FunctionAnalysisManager &FAM =
+      MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  FIInjectionInstrumenter Instrumenter(M);
+  for (Function &F : M) {
+    if (F.isDeclaration() || FIInjectionInstrumenter::isRuntimeFunction(&F))
+      continue;
+    Instrumenter.collectSites(F, FAM.getResult<FIVulnerabilityAnalysis>(F));
+  }
+
+  // Sites are collected up front so instrumentation never sees its own hooks
+  Instrumenter.instrument();
+
+  const std::vector<InjectionSite> &Sites = Instrumenter.getSites();
+  unsigned Counts[3] = {0, 0, 0};
+  for (const InjectionSite &Site : Sites)
+    Counts[static_cast<unsigned>(Site.Kind)]++;
+  errs() << "  Value sites:  " << Counts[0] << "\n";
+  errs() << "  Store sites:  " << Counts[1] << "\n";
+  errs() << "  Branch sites: " << Counts[2] << "\n";
+  errs() << "  Checkpoints:  " << Instrumenter.getNumCheckpoints() << "\n";
+
+  if (!InjectSiteMap.empty()) {
+    std::error_code EC;
+    raw_fd_ostream OS(InjectSiteMap, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "  [ERROR] Cannot write site map '" << InjectSiteMap
+             << "': " << EC.message() << "\n";
+    } else {
+      Instrumenter.writeSiteMap(OS);
+      errs() << "  Site map written to " << InjectSiteMap << "\n";
+    }
+  }
+
+  return Sites.empty() && !Instrumenter.getNumCheckpoints()
+             ? PreservedAnalyses::all()
+             : PreservedAnalyses::none();
+}
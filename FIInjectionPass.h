@@ -0,0 +1,20 @@
+// FIInjectionPass.h
+// In-process fault injection instrumentation pass
+//
+// Registered as "fi-inject" by the FIHardeningTransform plugin. Inserts
+// hooks into the FIInjectionRuntime so fault injection campaigns can run
+// on the (hardened) binary itself instead of through an LLFI build.
+
+#ifndef FI_INJECTION_PASS_H
+#define FI_INJECTION_PASS_H
+
+#include "llvm/IR/PassManager.h"
+
+class FIInjectionPass : public llvm::PassInfoMixin<FIInjectionPass> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+  static bool isRequired() { return true; }
+};
+
+#endif // FI_INJECTION_PASS_H
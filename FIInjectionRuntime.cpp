@@ -0,0 +1,451 @@
+// FIInjectionRuntime.cpp
+// In-process fault injection runtime implementation
+
+#include "FIInjectionRuntime.h"
+#include "FIHardeningRuntime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Active injection target; site == FI_INJECT_NO_SITE disarms every hook
+static fi_inject_config_t g_config = {FI_INJECT_NO_SITE, FI_FAULT_NONE, 0, 0, 0};
+
+// Dynamic executions of the target site seen so far
+static uint64_t g_instance_count = 0;
+
+// Set once the fault has been injected
+static int g_fired = 0;
+
+// Value the armed site produced on its latest execution (FI_FAULT_SKIP)
+static uint64_t g_last_value = 0;
+
+// Executions of all sites, and its value when the fault was injected
+static uint64_t g_site_executions = 0;
+static uint64_t g_fired_at = 0;
+
+// Per-trial state shared between the fork server and the trial process
+typedef struct {
+  uint32_t injected;
+  uint32_t diverged;
+  uint32_t detected;
+  uint64_t latency;
+  char detection[FI_DETECTION_MAX];
+} fi_trial_shared_t;
+
+static fi_trial_shared_t *g_trial_shared = NULL;
+
+// Golden output trace, recorded once per fork server (see header)
+typedef struct {
+  uint64_t offset;  // Bytes of stdout produced so far
+  uint64_t hash;    // FNV-1a of those bytes
+} fi_trace_entry_t;
+
+typedef struct {
+  uint32_t count;
+  fi_trace_entry_t entries[FI_TRACE_MAX_ENTRIES];
+} fi_trace_t;
+
+static fi_trace_t *g_trace = NULL;
+static uint32_t g_trace_mode = 0;   // FI_TRIAL_RECORD_TRACE / FI_TRIAL_CHECK_TRACE
+static uint64_t g_trace_offset = 0;
+static uint64_t g_trace_hash = 0;
+static uint32_t g_trace_next = 0;   // Next golden entry to compare against
+static uint64_t g_trace_calls = 0;
+
+#define FI_TRACE_INTERVAL 64
+
+#define FI_FNV_OFFSET 0xcbf29ce484222325ull
+#define FI_FNV_PRIME  0x100000001b3ull
+
+// Profiling run (FI_PROFILE_OUT): dynamic execution count per site
+static uint64_t *g_profile_counts = NULL;
+static uint32_t g_profile_size = 0;
+static const char *g_profile_path = NULL;
+
+static void fi_profile_hit(uint32_t site) {
+  if (site >= g_profile_size) {
+    uint32_t size = g_profile_size ? g_profile_size : 1024;
+    while (size <= site)
+      size *= 2;
+    uint64_t *counts = (uint64_t *)realloc(g_profile_counts, size * sizeof(uint64_t));
+    if (!counts)
+      return;
+    memset(counts + g_profile_size, 0, (size - g_profile_size) * sizeof(uint64_t));
+    g_profile_counts = counts;
+    g_profile_size = size;
+  }
+  g_profile_counts[site]++;
+}
+
+// One "site<TAB>count" line per executed site
+static void fi_profile_write(void) {
+  FILE *out = fopen(g_profile_path, "w");
+  if (!out) {
+    fprintf(stderr, "[FI-Inject] Cannot write profile '%s'\n", g_profile_path);
+    return;
+  }
+  fprintf(out, "# site\tcount\n");
+  for (uint32_t site = 0; site < g_profile_size; ++site)
+    if (g_profile_counts[site])
+      fprintf(out, "%u\t%llu\n", site, (unsigned long long)g_profile_counts[site]);
+  fclose(out);
+}
+
+void fi_inject_configure(const fi_inject_config_t *config) {
+  g_config = *config;
+  if (g_config.instance == 0)
+    g_config.instance = 1;
+  g_instance_count = 0;
+  g_fired = 0;
+  g_last_value = 0;
+  g_site_executions = 0;
+  g_fired_at = 0;
+}
+
+int fi_inject_fired(void) {
+  return g_fired;
+}
+
+void fi_inject_note_detection(const char *type, const char *location) {
+  if (!g_trial_shared)
+    return;
+  g_trial_shared->detected = 1;
+  g_trial_shared->latency = g_fired ? g_site_executions - g_fired_at : 0;
+  snprintf(g_trial_shared->detection, sizeof(g_trial_shared->detection),
+           "%s\t%s", type ? type : "unknown", location ? location : "unknown");
+}
+
+#define FI_MODEL_BIT(m) (1u << (m))
+#define FI_VALUE_MODELS                                                   \
+  (FI_MODEL_BIT(FI_FAULT_BITFLIP) | FI_MODEL_BIT(FI_FAULT_SKIP) |         \
+   FI_MODEL_BIT(FI_FAULT_DOUBLE_BIT) | FI_MODEL_BIT(FI_FAULT_BYTE_BURST))
+#define FI_BRANCH_MODELS                                                  \
+  (FI_MODEL_BIT(FI_FAULT_BRANCH_INVERT) | FI_MODEL_BIT(FI_FAULT_SKIP))
+
+// Returns 1 if this execution of the site is the one to corrupt; models is
+// the set of FI_MODEL_BIT()s the calling hook implements
+static inline int fi_inject_hit(uint32_t site, uint32_t models) {
+  g_site_executions++;
+  if (__builtin_expect(g_profile_path != NULL, 0))
+    fi_profile_hit(site);
+  if (__builtin_expect(site != g_config.site, 1))
+    return 0;
+  if (g_fired || !(models & FI_MODEL_BIT(g_config.model)))
+    return 0;
+  if (++g_instance_count != g_config.instance)
+    return 0;
+  g_fired = 1;
+  g_fired_at = g_site_executions;
+  if (g_trial_shared)
+    g_trial_shared->injected = 1;
+  return 1;
+}
+
+uint64_t fi_inject_value(uint32_t site, uint64_t value, uint32_t width) {
+  if (!fi_inject_hit(site, FI_VALUE_MODELS)) {
+    if (__builtin_expect(site == g_config.site, 0))
+      g_last_value = value;
+    return value;
+  }
+
+  uint32_t bit = width ? g_config.bit % width : 0;
+  uint64_t mask = width >= 64 ? ~0ull : ((uint64_t)1 << width) - 1;
+  switch (g_config.model) {
+  case FI_FAULT_SKIP:
+    return g_last_value;
+  case FI_FAULT_DOUBLE_BIT:
+    if (width < 2)
+      break;
+    return value ^ ((uint64_t)1 << bit) ^ ((uint64_t)1 << ((bit + 1) % width));
+  case FI_FAULT_BYTE_BURST: {
+    uint32_t shift = bit & ~7u;
+    uint64_t burst = (g_config.pattern & 0xFF) ? (g_config.pattern & 0xFF) : 0xFF;
+    burst = (burst << shift) & mask;
+    return value ^ (burst ? burst : (uint64_t)1 << bit);
+  }
+  default:
+    break;
+  }
+  return value ^ ((uint64_t)1 << bit);
+}
+
+int fi_inject_skip(uint32_t site) {
+  return fi_inject_hit(site, FI_MODEL_BIT(FI_FAULT_SKIP));
+}
+
+int fi_inject_branch(uint32_t site, int condition) {
+  if (!fi_inject_hit(site, FI_BRANCH_MODELS))
+    return condition;
+  // A skipped conditional jump falls through to the false edge
+  return g_config.model == FI_FAULT_SKIP ? 0 : !condition;
+}
+
+// ===== OUTPUT TRACE =====
+
+static void fi_trace_hash(const unsigned char *p, size_t n) {
+  uint64_t h = g_trace_hash;
+  for (size_t i = 0; i < n; ++i)
+    h = (h ^ p[i]) * FI_FNV_PRIME;
+  g_trace_hash = h;
+  g_trace_offset += n;
+}
+
+// Hash new output, checking the golden hash at every golden boundary
+static void fi_trace_check(const unsigned char *p, size_t n) {
+  while (n) {
+    if (g_trace_next >= g_trace->count) {
+      fi_trace_hash(p, n);
+      return;
+    }
+    const fi_trace_entry_t *e = &g_trace->entries[g_trace_next];
+    uint64_t gap = e->offset - g_trace_offset;
+    size_t take = gap < n ? (size_t)gap : n;
+    fi_trace_hash(p, take);
+    p += take;
+    n -= take;
+    if (g_trace_offset != e->offset)
+      return;
+    if (g_trace_hash != e->hash) {
+      // The trial's output already differs from the golden output
+      g_trial_shared->diverged = 1;
+      _exit(0);
+    }
+    g_trace_next++;
+  }
+}
+
+void fi_inject_checkpoint(void) {
+  if (__builtin_expect(!g_trace_mode, 1))
+    return;
+  // Look at the file only every FI_TRACE_INTERVAL output calls
+  if (++g_trace_calls % FI_TRACE_INTERVAL)
+    return;
+
+  // No fflush: stdio flushes at the same points in every run up to the
+  // first difference, so only bytes that actually reached the file are
+  // compared
+  struct stat st;
+  if (fstat(STDOUT_FILENO, &st) != 0 || (uint64_t)st.st_size == g_trace_offset)
+    return;
+
+  unsigned char buf[4096];
+  while (g_trace_offset < (uint64_t)st.st_size) {
+    ssize_t n = pread(STDOUT_FILENO, buf, sizeof(buf), (off_t)g_trace_offset);
+    if (n <= 0) {
+      g_trace_mode = 0; // stdout is not readable; give up on tracing
+      return;
+    }
+    if (g_trace_mode == FI_TRIAL_CHECK_TRACE)
+      fi_trace_check(buf, (size_t)n);
+    else
+      fi_trace_hash(buf, (size_t)n);
+  }
+
+  if (g_trace_mode == FI_TRIAL_RECORD_TRACE) {
+    uint32_t count = g_trace->count;
+    if (count < FI_TRACE_MAX_ENTRIES &&
+        (count == 0 || g_trace->entries[count - 1].offset != g_trace_offset)) {
+      g_trace->entries[count].offset = g_trace_offset;
+      g_trace->entries[count].hash = g_trace_hash;
+      g_trace->count = count + 1;
+    }
+  }
+}
+
+uint64_t fi_selftest_shadow(uint32_t site, uint64_t value, uint32_t width,
+                            uint32_t salt) {
+  if (__builtin_expect(site != g_config.site, 1) ||
+      g_config.model != FI_FAULT_SHADOW)
+    return value;
+  if (!g_fired) {
+    g_fired = 1;
+    g_fired_at = g_site_executions;
+    if (g_trial_shared)
+      g_trial_shared->injected = 1;
+  }
+  uint64_t mask = width >= 64 ? ~0ull : (((uint64_t)1 << width) - 1);
+  uint64_t pattern = (g_config.pattern ? g_config.pattern : 1) & mask;
+  if (!pattern)
+    pattern = 1;
+  // The complement within width, or bit 0 flipped if that is empty: never
+  // zero and never the unsalted pattern once width >= 2
+  if (salt) {
+    uint64_t other = ~pattern & mask;
+    pattern = other ? other : pattern ^ 1;
+  }
+  return value ^ pattern;
+}
+
+static uint32_t parse_model(const char *name) {
+  if (!name || !strcmp(name, "bitflip"))
+    return FI_FAULT_BITFLIP;
+  if (!strcmp(name, "skip"))
+    return FI_FAULT_SKIP;
+  if (!strcmp(name, "branch"))
+    return FI_FAULT_BRANCH_INVERT;
+  if (!strcmp(name, "shadow"))
+    return FI_FAULT_SHADOW;
+  if (!strcmp(name, "double-bit"))
+    return FI_FAULT_DOUBLE_BIT;
+  if (!strcmp(name, "byte-burst"))
+    return FI_FAULT_BYTE_BURST;
+  fprintf(stderr, "[FI-Inject] Unknown fault model '%s', using bitflip\n", name);
+  return FI_FAULT_BITFLIP;
+}
+
+// ===== FORK SERVER =====
+
+static int read_full(int fd, void *buf, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, (char *)buf + done, size - done);
+    if (n <= 0)
+      return 0;
+    done += (size_t)n;
+  }
+  return 1;
+}
+
+static int write_full(int fd, const void *buf, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(fd, (const char *)buf + done, size - done);
+    if (n <= 0)
+      return 0;
+    done += (size_t)n;
+  }
+  return 1;
+}
+
+// Serve trials until the runner closes the control pipe. Returns only in
+// trial processes, which then continue from the snapshot point.
+static void fi_forkserver_run(void) {
+  uint32_t hello = FI_FORKSRV_HELLO;
+  if (!write_full(FI_FORKSRV_ST_FD, &hello, sizeof(hello)))
+    return; // Not started by fi-campaign
+
+  g_trial_shared = (fi_trial_shared_t *)mmap(
+      NULL, sizeof(fi_trial_shared_t), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (g_trial_shared == MAP_FAILED) {
+    fprintf(stderr, "[FI-Inject] Fork server: cannot map trial state\n");
+    _exit(1);
+  }
+
+  g_trace = (fi_trace_t *)mmap(NULL, sizeof(fi_trace_t), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (g_trace == MAP_FAILED) {
+    fprintf(stderr, "[FI-Inject] Fork server: cannot map output trace\n");
+    _exit(1);
+  }
+  g_trace->count = 0;
+
+  // Trial output must start empty, so nothing may sit in stdio buffers
+  fflush(NULL);
+
+  for (;;) {
+    fi_trial_request_t request;
+    if (!read_full(FI_FORKSRV_CTL_FD, &request, sizeof(request)))
+      _exit(0);
+
+    memset(g_trial_shared, 0, sizeof(*g_trial_shared));
+    if (request.flags & FI_TRIAL_RECORD_TRACE)
+      g_trace->count = 0;
+
+    pid_t pid = fork();
+    if (pid < 0)
+      _exit(1);
+
+    if (pid == 0) {
+      close(FI_FORKSRV_CTL_FD);
+      close(FI_FORKSRV_ST_FD);
+      // Every trial reads its input from the start (offsets are shared)
+      lseek(STDIN_FILENO, 0, SEEK_SET);
+      fi_set_error_mode(FI_ERROR_EXIT);
+      fi_inject_configure(&request.inject);
+      // The runner truncates the output file before every trial
+      g_trace_mode = request.flags & (FI_TRIAL_RECORD_TRACE | FI_TRIAL_CHECK_TRACE);
+      if (g_trace_mode == FI_TRIAL_CHECK_TRACE && g_trace->count == 0)
+        g_trace_mode = 0;
+      g_trace_offset = 0;
+      g_trace_hash = FI_FNV_OFFSET;
+      g_trace_next = 0;
+      g_trace_calls = 0;
+      return;
+    }
+
+    int32_t child = (int32_t)pid;
+    if (!write_full(FI_FORKSRV_ST_FD, &child, sizeof(child)))
+      _exit(1);
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0)
+      _exit(1);
+
+    fi_trial_result_t result;
+    result.status = status;
+    result.injected = g_trial_shared->injected;
+    result.diverged = g_trial_shared->diverged;
+    result.detected = g_trial_shared->detected;
+    result.latency = g_trial_shared->latency;
+    memcpy(result.detection, g_trial_shared->detection, sizeof(result.detection));
+    if (!write_full(FI_FORKSRV_ST_FD, &result, sizeof(result)))
+      _exit(1);
+  }
+}
+
+void fi_forkserver_checkpoint(void) {
+  static int started = 0;
+  if (started || !getenv("FI_FORKSERVER_DEFERRED"))
+    return;
+  started = 1;
+  // Deferred trials count instances from here, so the profiling run
+  // drops the setup work before it too
+  if (g_profile_path) {
+    if (g_profile_counts)
+      memset(g_profile_counts, 0, g_profile_size * sizeof(uint64_t));
+    return;
+  }
+  if (getenv("FI_FORKSERVER"))
+    fi_forkserver_run();
+}
+
+// Pick up a single-shot injection target from the environment, or start
+// the fork server so the program pauses at main() between trials
+__attribute__((constructor))
+static void fi_inject_constructor(void) {
+  g_profile_path = getenv("FI_PROFILE_OUT");
+  if (g_profile_path)
+    atexit(fi_profile_write);
+
+  if (getenv("FI_FORKSERVER")) {
+    if (!getenv("FI_FORKSERVER_DEFERRED"))
+      fi_forkserver_run();
+    return;
+  }
+
+  const char *site = getenv("FI_INJECT_SITE");
+  if (!site)
+    return;
+  // Under FI_REPLICAS, inject into one replica only
+  const char *replica = getenv("FI_INJECT_REPLICA");
+  if (replica && fi_replica_id() != atoi(replica))
+    return;
+
+  fi_inject_config_t config;
+  config.site = (uint32_t)strtoul(site, NULL, 0);
+  config.model = parse_model(getenv("FI_INJECT_MODEL"));
+  const char *instance = getenv("FI_INJECT_INSTANCE");
+  config.instance = instance ? strtoull(instance, NULL, 0) : 1;
+  const char *bit = getenv("FI_INJECT_BIT");
+  config.bit = bit ? (uint32_t)strtoul(bit, NULL, 0) : 0;
+  const char *pattern = getenv("FI_INJECT_PATTERN");
+  config.pattern = pattern ? strtoull(pattern, NULL, 0) : 0;
+  fi_inject_configure(&config);
+}
@@ -0,0 +1,119 @@
+// FIInjectionRuntime.h
+// Runtime support for in-process fault injection
+//
+// The fi-inject pass (FIInjectionPass.cpp) inserts calls to the hooks
+// below at selected instruction kinds. Each hook carries a static site ID;
+// a fault is injected when the configured site reaches the configured
+// dynamic instance. Everything else returns the original value.
+
+#ifndef FI_INJECTION_RUNTIME_H
+#define FI_INJECTION_RUNTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fault models. Value sites accept BITFLIP, SKIP (the result keeps the
+// value this instruction produced on its previous execution, like a
+// destination register that was never written), DOUBLE_BIT and BYTE_BURST;
+// store sites accept SKIP (the store is dropped); branch sites accept
+// BRANCH_INVERT and SKIP (the branch falls through to its false edge).
+typedef enum {
+  FI_FAULT_NONE = 0,
+  FI_FAULT_BITFLIP,        // Flip one bit of an instruction result
+  FI_FAULT_SKIP,           // Skip the instruction
+  FI_FAULT_BRANCH_INVERT,  // Invert a conditional branch direction
+  FI_FAULT_SHADOW,         // Corrupt a hardening shadow copy (self-test builds)
+  FI_FAULT_DOUBLE_BIT,     // Flip two adjacent bits (bit, bit + 1)
+  FI_FAULT_BYTE_BURST      // XOR a byte pattern into the byte holding bit
+} fi_fault_model_t;
+
+#define FI_INJECT_NO_SITE 0xFFFFFFFFu
+
+// Injection target for one run (or one trial)
+typedef struct {
+  uint32_t site;      // Site ID from the pass site map (FI_INJECT_NO_SITE = off)
+  uint32_t model;     // fi_fault_model_t
+  uint64_t instance;  // Dynamic instance of the site to corrupt (1-based)
+  uint32_t bit;       // Bit to flip for FI_FAULT_BITFLIP
+  uint64_t pattern;   // XOR pattern for FI_FAULT_SHADOW (0 = 1) and the
+                      // low byte for FI_FAULT_BYTE_BURST (0 = 0xFF)
+} fi_inject_config_t;
+
+// ===== FORK SERVER PROTOCOL (fi-campaign) =====
+//
+// When FI_FORKSERVER is set, the runtime stops before main() and serves
+// trials: for each fi_trial_request_t read from FI_FORKSRV_CTL_FD it forks,
+// reports the child pid and then the fi_trial_result_t on FI_FORKSRV_ST_FD.
+// With FI_FORKSERVER_DEFERRED the server starts at the first
+// fi_forkserver_checkpoint() call instead, skipping fault-free setup work;
+// dynamic instances are then counted from the checkpoint, and so are the
+// site counts of a FI_PROFILE_OUT run.
+//
+// Output checkpoints: the fi-inject pass calls fi_inject_checkpoint() after
+// every output library call. In a FI_TRIAL_RECORD_TRACE trial (the golden
+// run) the runtime records the running hash of stdout at each checkpoint
+// into memory shared with the fork server; FI_TRIAL_CHECK_TRACE trials hash
+// their own stdout as it is produced and exit as soon as a prefix differs
+// from the golden trace (result.diverged). stdout must be a readable file.
+
+#define FI_FORKSRV_CTL_FD 198
+#define FI_FORKSRV_ST_FD  199
+#define FI_FORKSRV_HELLO  0x46494653u  // "FIFS"
+
+// fi_trial_request_t flags
+#define FI_TRIAL_RECORD_TRACE 0x1u
+#define FI_TRIAL_CHECK_TRACE  0x2u
+
+// Golden trace capacity (checkpoints where the output grew)
+#define FI_TRACE_MAX_ENTRIES 65536
+
+typedef struct {
+  fi_inject_config_t inject;
+  uint32_t flags;
+} fi_trial_request_t;
+
+#define FI_DETECTION_MAX 96
+
+typedef struct {
+  int32_t status;      // waitpid() status of the trial process
+  uint32_t injected;   // Nonzero if the fault was actually injected
+  uint32_t diverged;   // Nonzero if stopped early on output divergence
+  uint32_t detected;   // Nonzero if a hardening check reported the fault
+  uint64_t latency;    // Site executions from injection to detection
+  char detection[FI_DETECTION_MAX];  // "type<TAB>location" of that check
+} fi_trial_result_t;
+
+void fi_forkserver_checkpoint(void);
+
+// Configuration (also read from FI_INJECT_SITE, FI_INJECT_INSTANCE,
+// FI_INJECT_MODEL, FI_INJECT_BIT and FI_INJECT_PATTERN at startup). With FI_PROFILE_OUT set,
+// the dynamic execution count of every site is written there at exit.
+void fi_inject_configure(const fi_inject_config_t *config);
+int fi_inject_fired(void);
+
+// Called by the hardening runtime when a check fires in FI_ERROR_EXIT mode
+void fi_inject_note_detection(const char *type, const char *location);
+
+// Hooks inserted by the fi-inject pass
+uint64_t fi_inject_value(uint32_t site, uint64_t value, uint32_t width);
+int fi_inject_skip(uint32_t site);
+int fi_inject_branch(uint32_t site, int condition);
+void fi_inject_checkpoint(void);
+
+// Hook inserted on shadow copies by -fi-harden-self-test. With the
+// FI_FAULT_SHADOW model armed at this site, every execution returns
+// value ^ pattern (truncated to width) so the check that compares against
+// the shadow must fire. A non-zero salt takes a different non-zero pattern
+// for the same site, so two TMR clones never agree on a corrupted value.
+uint64_t fi_selftest_shadow(uint32_t site, uint64_t value, uint32_t width,
+                            uint32_t salt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FI_INJECTION_RUNTIME_H
@@ -0,0 +1,411 @@
+// FIReplicaRuntime.cpp
+// Process-level redundancy: replicated execution with output voting
+//
+// With FI_REPLICAS=2 or 3 in the environment, the process forks that many
+// replicas of itself before main() and stays behind as their supervisor.
+// The replicas run the unhardened program independently and meet only at
+// output points: every write() or send() (through -Wl,--wrap), every flush
+// of stdout/stderr and exit() deposits its arguments - fd, length, an
+// FNV-1a hash of the bytes, the exit status - in a shared-memory ring. Once
+// every live replica has arrived, the arguments are voted on: a replica in
+// the majority performs the system call once and hands the result to the
+// others, a replica in the minority is dropped, and no majority (two
+// replicas disagreeing) is a detection reported through the usual failure
+// path. Three replicas therefore mask one fault; two only detect it.
+//
+// Replicas must behave deterministically: single-threaded programs reading
+// their input from regular files (or not at all).
+
+#include "FIHardeningRuntime.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define FI_REPLICAS_MAX 3
+#define FI_REPLICA_RING 8                 // Output slots in flight
+#define FI_REPLICA_DEFAULT_TIMEOUT 10000  // ms to wait for a lagging replica
+
+enum { OUTPUT_WRITE = 1, OUTPUT_SEND, OUTPUT_EXIT };
+
+// One replica's arguments for one output
+typedef struct {
+  std::atomic<uint64_t> seq;  // Published last; the output number
+  uint32_t kind;
+  int32_t fd;
+  uint64_t len;
+  uint64_t hash;
+  int64_t arg;                // send() flags or exit status
+} replica_record_t;
+
+typedef struct {
+  replica_record_t records[FI_REPLICAS_MAX];
+  std::atomic<uint64_t> claimed;  // Output number whose decision is taken
+  std::atomic<uint64_t> decided;
+  std::atomic<uint64_t> done;
+  int32_t decider;
+  int32_t performer;   // Replica doing the system call
+  uint32_t dropped;    // Replicas outside the majority
+  uint32_t fatal;      // No majority
+  int64_t result;
+  int32_t error;       // errno of the system call
+} replica_slot_t;
+
+typedef struct {
+  uint32_t replicas;
+  std::atomic<uint32_t> alive;    // Bit per live replica
+  std::atomic<uint32_t> dropped;  // Replicas that left the vote quietly
+  pid_t pids[FI_REPLICAS_MAX];
+  replica_slot_t slots[FI_REPLICA_RING];
+  std::atomic<uint32_t> exit_decided;
+  int32_t exit_status;
+  std::atomic<uint64_t> outputs;
+  std::atomic<uint32_t> lost;
+} replica_shared_t;
+
+static replica_shared_t *g_shared = NULL;
+static int g_replica = -1;    // This process's replica, -1 if not replicated
+static uint64_t g_seq = 0;    // Outputs so far
+static long g_timeout_ms = FI_REPLICA_DEFAULT_TIMEOUT;
+
+static const char *output_name(uint32_t kind) {
+  return kind == OUTPUT_WRITE ? "write" : kind == OUTPUT_SEND ? "send" : "exit";
+}
+
+static uint64_t hash_bytes(const void *buf, size_t len) {
+  const unsigned char *p = (const unsigned char *)buf;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < len; ++i)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
+static long elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void backoff(unsigned *spins) {
+  if (++*spins < 1024) {
+    sched_yield();
+  } else {
+    struct timespec nap = {0, 100000};
+    nanosleep(&nap, NULL);
+  }
+}
+
+static int same_output(const replica_record_t *a, const replica_record_t *b) {
+  return a->kind == b->kind && a->fd == b->fd && a->len == b->len &&
+         a->hash == b->hash && a->arg == b->arg;
+}
+
+// Diagnostics go straight to fd 2: stderr itself is voted on in replicas
+static void replica_note(const char *what, const replica_record_t *r, int replica,
+                         uint64_t seq) {
+  dprintf(STDERR_FILENO, "[FI-Replica] Replica %d %s at output #%llu (%s, fd %d)\n",
+          replica, what, (unsigned long long)seq, output_name(r->kind), r->fd);
+}
+
+// Wait until every live replica has deposited output seq, or for the timeout
+static void wait_for_replicas(replica_slot_t *slot, uint64_t seq) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  unsigned spins = 0;
+  for (;;) {
+    uint32_t alive = g_shared->alive.load(std::memory_order_acquire);
+    uint32_t missing = 0;
+    for (uint32_t r = 0; r < g_shared->replicas; ++r)
+      if ((alive & (1u << r)) &&
+          slot->records[r].seq.load(std::memory_order_acquire) != seq)
+        missing |= 1u << r;
+    if (!missing || elapsed_ms(&start) > g_timeout_ms)
+      return;
+    backoff(&spins);
+  }
+}
+
+// Majority vote over the replicas that arrived; laggards count as dissent
+static void decide(replica_slot_t *slot, uint64_t seq) {
+  uint32_t alive = g_shared->alive.load(std::memory_order_acquire);
+  uint32_t voters = __builtin_popcount(alive);
+  uint32_t best_mask = 0, best_count = 0;
+  for (uint32_t r = 0; r < g_shared->replicas; ++r) {
+    if (!(alive & (1u << r)) || slot->records[r].seq.load() != seq)
+      continue;
+    uint32_t mask = 0;
+    for (uint32_t o = 0; o < g_shared->replicas; ++o)
+      if ((alive & (1u << o)) && slot->records[o].seq.load() == seq &&
+          same_output(&slot->records[r], &slot->records[o]))
+        mask |= 1u << o;
+    if ((uint32_t)__builtin_popcount(mask) > best_count) {
+      best_count = __builtin_popcount(mask);
+      best_mask = mask;
+    }
+  }
+
+  slot->decider = g_replica;
+  slot->fatal = best_count * 2 <= voters;
+  slot->dropped = slot->fatal ? 0 : alive & ~best_mask;
+  slot->performer = slot->fatal ? g_replica : __builtin_ctz(best_mask);
+  for (uint32_t r = 0; r < g_shared->replicas; ++r) {
+    if (!(slot->dropped & (1u << r)))
+      continue;
+    bool arrived = slot->records[r].seq.load() == seq;
+    replica_note(arrived ? "diverged" : "timed out",
+                 &slot->records[arrived ? r : slot->performer], r, seq);
+    // The supervisor publishes a pid only after its fork returned, and
+    // kill(0) would hit the whole process group
+    pid_t pid = g_shared->pids[r];
+    if (!arrived && pid > 0)
+      kill(pid, SIGKILL);
+    g_shared->lost.fetch_add(1);
+  }
+  g_shared->dropped.fetch_or(slot->dropped);
+  g_shared->alive.fetch_and(~slot->dropped);
+  slot->decided.store(seq, std::memory_order_release);
+}
+
+// Stop taking part in the vote; later output goes straight to the fds
+static void replica_detach(void) {
+  g_shared->alive.fetch_and(~(1u << g_replica));
+  g_replica = -1;
+}
+
+// Vote on one output and return the result of its system call
+static int64_t replicate(uint32_t kind, int fd, const void *buf, size_t len,
+                         int64_t arg) {
+  uint64_t seq = ++g_seq;
+  replica_slot_t *slot = &g_shared->slots[seq % FI_REPLICA_RING];
+  replica_record_t *mine = &slot->records[g_replica];
+  mine->kind = kind;
+  mine->fd = fd;
+  mine->len = len;
+  mine->hash = buf ? hash_bytes(buf, len) : 0;
+  mine->arg = arg;
+  mine->seq.store(seq, std::memory_order_release);
+
+  wait_for_replicas(slot, seq);
+  uint64_t claimed = slot->claimed.load();
+  while (claimed < seq && !slot->claimed.compare_exchange_weak(claimed, seq)) {}
+  if (claimed < seq)
+    decide(slot, seq);
+
+  unsigned spins = 0;
+  while (slot->decided.load(std::memory_order_acquire) != seq)
+    backoff(&spins);
+
+  if (slot->dropped & (1u << g_replica))
+    _exit(0);  // Outvoted: the majority carries on without this replica
+  if (slot->fatal) {
+    if (slot->decider != g_replica) {
+      g_shared->dropped.fetch_or(1u << g_replica);
+      replica_detach();
+      _exit(0);
+    }
+    const replica_record_t *other = mine;
+    for (uint32_t r = 0; r < g_shared->replicas; ++r)
+      if (slot->records[r].seq.load() == seq && !same_output(mine, &slot->records[r]))
+        other = &slot->records[r];
+    replica_detach();
+    fi_mismatch_int64((int64_t)mine->hash, (int64_t)other->hash, "replica:output");
+    // Log mode: keep going alone, and this output is this replica's own
+    if (kind == OUTPUT_WRITE)
+      return syscall(SYS_write, fd, buf, len);
+    if (kind == OUTPUT_SEND)
+      return syscall(SYS_sendto, fd, buf, len, (int)arg, NULL, 0);
+    return 0;
+  }
+
+  if (slot->performer == g_replica) {
+    g_shared->outputs.fetch_add(1);
+    int64_t result = 0;
+    if (kind == OUTPUT_WRITE)
+      result = syscall(SYS_write, fd, buf, len);
+    else if (kind == OUTPUT_SEND)
+      result = syscall(SYS_sendto, fd, buf, len, (int)arg, NULL, 0);
+    else {
+      g_shared->exit_status = (int32_t)arg;
+      g_shared->exit_decided.store(1);
+    }
+    slot->result = result;
+    slot->error = errno;
+    slot->done.store(seq, std::memory_order_release);
+  } else {
+    while (slot->done.load(std::memory_order_acquire) != seq)
+      backoff(&spins);
+  }
+  errno = slot->error;
+  return slot->result;
+}
+
+// ===== OUTPUT POINTS =====
+
+extern "C" ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+  if (g_replica < 0)
+    return syscall(SYS_write, fd, buf, count);
+  return replicate(OUTPUT_WRITE, fd, buf, count, 0);
+}
+
+extern "C" ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags) {
+  if (g_replica < 0)
+    return syscall(SYS_sendto, fd, buf, len, flags, NULL, 0);
+  return replicate(OUTPUT_SEND, fd, buf, len, flags);
+}
+
+// stdio flushes stdout/stderr through these cookies, one vote per flush
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+  int fd = (int)(intptr_t)cookie;
+  ssize_t done = 0;
+  while ((size_t)done < size) {
+    ssize_t n = __wrap_write(fd, buf + done, size - done);
+    if (n <= 0)
+      return done ? done : -1;
+    done += n;
+  }
+  return done;
+}
+
+static FILE *voted_stream(int fd, int mode) {
+  cookie_io_functions_t io = {NULL, cookie_write, NULL, NULL};
+  FILE *stream = fopencookie((void *)(intptr_t)fd, "w", io);
+  if (!stream)
+    return NULL;
+  setvbuf(stream, NULL, mode, BUFSIZ);
+  return stream;
+}
+
+static void replica_exit(int status, void *) {
+  if (g_replica < 0)
+    return;
+  fflush(NULL);
+  replicate(OUTPUT_EXIT, -1, NULL, 0, status);
+}
+
+// ===== STARTUP AND SUPERVISOR =====
+
+// Wait for all replicas and exit the way the majority did
+static void supervise(void) {
+  int last_status = 0;
+  for (;;) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (uint32_t r = 0; r < g_shared->replicas; ++r) {
+      if (g_shared->pids[r] != pid || (g_shared->dropped.load() & (1u << r)))
+        continue;
+      // Not outvoted: it finished, crashed, or reported a detection
+      bool was_alive = g_shared->alive.fetch_and(~(1u << r)) & (1u << r);
+      if (was_alive && !g_shared->exit_decided.load() && WIFSIGNALED(status)) {
+        dprintf(STDERR_FILENO, "[FI-Replica] Replica %u terminated by signal %d\n",
+                r, WTERMSIG(status));
+        g_shared->lost.fetch_add(1);
+      }
+      last_status = status;
+    }
+  }
+
+  uint32_t lost = g_shared->lost.load();
+  if (lost)
+    dprintf(STDERR_FILENO, "[FI-Replica] %llu output(s) voted, %u replica(s) lost\n",
+            (unsigned long long)g_shared->outputs.load(), lost);
+  if (g_shared->exit_decided.load())
+    _exit(g_shared->exit_status);
+  if (WIFSIGNALED(last_status)) {
+    signal(WTERMSIG(last_status), SIG_DFL);
+    raise(WTERMSIG(last_status));
+  }
+  _exit(WIFEXITED(last_status) ? WEXITSTATUS(last_status) : 1);
+}
+
+static void replica_setup(int replica) {
+  g_replica = replica;
+  // A regular-file stdin is reopened so every replica reads all of it
+  struct stat st;
+  if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode)) {
+    off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    int fd = open("/proc/self/fd/0", O_RDONLY);
+    if (fd >= 0) {
+      lseek(fd, offset, SEEK_SET);
+      dup2(fd, STDIN_FILENO);
+      close(fd);
+    }
+  }
+  FILE *out = voted_stream(STDOUT_FILENO, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF);
+  FILE *err = voted_stream(STDERR_FILENO, _IONBF);
+  if (out)
+    stdout = out;
+  if (err)
+    stderr = err;
+  on_exit(replica_exit, NULL);
+}
+
+int fi_replica_id(void) {
+  return g_replica;
+}
+
+// After fi_runtime_init (101), before the fault injection constructor, so a
+// single-shot injection can target one replica (FI_INJECT_REPLICA)
+__attribute__((constructor(102)))
+static void fi_replica_constructor(void) {
+  const char *count = getenv("FI_REPLICAS");
+  if (!count || getenv("FI_FORKSERVER"))
+    return;
+  long replicas = strtol(count, NULL, 10);
+  if (replicas < 2 || replicas > FI_REPLICAS_MAX) {
+    if (replicas != 1 && replicas != 0)
+      fprintf(stderr, "[FI-Replica] FI_REPLICAS must be 2 or 3, running unreplicated\n");
+    return;
+  }
+  const char *timeout = getenv("FI_REPLICA_TIMEOUT_MS");
+  if (timeout && atol(timeout) > 0)
+    g_timeout_ms = atol(timeout);
+
+  g_shared = (replica_shared_t *)mmap(NULL, sizeof(replica_shared_t),
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (g_shared == MAP_FAILED) {
+    fprintf(stderr, "[FI-Replica] Cannot map shared state, running unreplicated\n");
+    g_shared = NULL;
+    return;
+  }
+  g_shared->replicas = (uint32_t)replicas;
+  g_shared->alive.store((1u << replicas) - 1);
+
+  // Nothing buffered before the fork may be written once per replica
+  fflush(NULL);
+  for (int r = 0; r < replicas; ++r) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "[FI-Replica] Cannot fork replica %d, running unreplicated\n", r);
+      for (int started = 0; started < r; ++started) {
+        kill(g_shared->pids[started], SIGKILL);
+        waitpid(g_shared->pids[started], NULL, 0);
+      }
+      munmap(g_shared, sizeof(replica_shared_t));
+      g_shared = NULL;
+      return;
+    }
+    if (pid == 0) {
+      replica_setup(r);
+      return;
+    }
+    g_shared->pids[r] = pid;
+  }
+  supervise();
+}
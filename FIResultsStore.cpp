@@ -0,0 +1,215 @@
+// FIResultsStore.cpp
+// Append-only columnar store for fault injection trial results
+
+#include "FIResultsStore.h"
+#include "FIInjectionRuntime.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+bool writeAll(int Fd, const void *Buf, size_t Size) {
+  size_t Done = 0;
+  while (Done < Size) {
+    ssize_t N = write(Fd, (const char *)Buf + Done, Size - Done);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Done += (size_t)N;
+  }
+  return true;
+}
+
+template <typename T> void appendColumn(std::string &Out, const std::vector<T> &Col) {
+  Out.append((const char *)Col.data(), Col.size() * sizeof(T));
+}
+
+// Bounds-checked cursor over a loaded file
+struct Cursor {
+  const char *Pos;
+  const char *End;
+
+  bool take(void *Out, size_t Size) {
+    if ((size_t)(End - Pos) < Size)
+      return false;
+    memcpy(Out, Pos, Size);
+    Pos += Size;
+    return true;
+  }
+
+  template <typename T> bool column(std::vector<T> &Col, uint32_t Rows) {
+    size_t Old = Col.size();
+    Col.resize(Old + Rows);
+    return take(Col.data() + Old, Rows * sizeof(T));
+  }
+};
+
+} // anonymous namespace
+
+const char *outcomeName(int O) {
+  static const char *Names[NUM_OUTCOMES] = {
+      "not-injected", "masked", "sdc", "detected", "crash", "hang"};
+  return O >= 0 && O < NUM_OUTCOMES ? Names[O] : "unknown";
+}
+
+const char *modelName(uint32_t Model) {
+  switch (Model) {
+  case FI_FAULT_BITFLIP:       return "bitflip";
+  case FI_FAULT_SKIP:          return "skip";
+  case FI_FAULT_BRANCH_INVERT: return "branch";
+  case FI_FAULT_SHADOW:        return "shadow";
+  case FI_FAULT_DOUBLE_BIT:    return "double-bit";
+  case FI_FAULT_BYTE_BURST:    return "byte-burst";
+  default:                     return "none";
+  }
+}
+
+uint32_t fiDetectionID(const std::string &Detection) {
+  uint32_t Hash = 0x811c9dc5u;
+  for (unsigned char C : Detection)
+    Hash = (Hash ^ C) * 0x01000193u;
+  return Hash ? Hash : 1;
+}
+
+bool FIResultsWriter::open(const std::string &Path) {
+  Fd = ::open(Path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (Fd < 0)
+    return false;
+  struct stat St;
+  if (fstat(Fd, &St) != 0)
+    return false;
+  if (St.st_size == 0) {
+    uint32_t Header[2] = {FI_RESULTS_MAGIC, FI_RESULTS_VERSION};
+    return writeAll(Fd, Header, sizeof(Header));
+  }
+  return true;
+}
+
+void FIResultsWriter::add(FITrialRecord Record, const std::string &Detection) {
+  if (!Detection.empty()) {
+    Record.Detection = fiDetectionID(Detection);
+    if (KnownStrings.insert(Record.Detection).second)
+      PendingStrings.emplace_back(Record.Detection, Detection);
+  }
+  Sites.push_back(Record.Site);
+  Models.push_back(Record.Model);
+  Bits.push_back(Record.Bit);
+  Outcomes.push_back(Record.Outcome);
+  Detections.push_back(Record.Detection);
+  Latencies.push_back(Record.Latency);
+  if (Sites.size() >= BlockRows)
+    flush();
+}
+
+bool FIResultsWriter::flush() {
+  if (Fd < 0)
+    return false;
+
+  // Strings go first so every trial block only references known IDs
+  std::string Block;
+  if (!PendingStrings.empty()) {
+    uint32_t Head[2] = {FI_BLOCK_STRINGS, (uint32_t)PendingStrings.size()};
+    Block.append((const char *)Head, sizeof(Head));
+    for (const auto &Entry : PendingStrings) {
+      uint32_t Fields[2] = {Entry.first, (uint32_t)Entry.second.size()};
+      Block.append((const char *)Fields, sizeof(Fields));
+      Block.append(Entry.second);
+    }
+    PendingStrings.clear();
+  }
+
+  if (!Sites.empty()) {
+    uint32_t Head[2] = {FI_BLOCK_TRIALS, (uint32_t)Sites.size()};
+    Block.append((const char *)Head, sizeof(Head));
+    appendColumn(Block, Sites);
+    appendColumn(Block, Models);
+    appendColumn(Block, Bits);
+    appendColumn(Block, Outcomes);
+    appendColumn(Block, Detections);
+    appendColumn(Block, Latencies);
+    Sites.clear();
+    Models.clear();
+    Bits.clear();
+    Outcomes.clear();
+    Detections.clear();
+    Latencies.clear();
+  }
+
+  // One write() per flush keeps blocks whole even with concurrent appenders
+  return Block.empty() || writeAll(Fd, Block.data(), Block.size());
+}
+
+void FIResultsWriter::close() {
+  if (Fd < 0)
+    return;
+  flush();
+  ::close(Fd);
+  Fd = -1;
+}
+
+bool FIResultsTable::load(const std::string &Path, std::string &Error) {
+  int Fd = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd < 0) {
+    Error = "cannot open '" + Path + "': " + strerror(errno);
+    return false;
+  }
+  std::string Data;
+  char Buf[1 << 16];
+  for (;;) {
+    ssize_t N = read(Fd, Buf, sizeof(Buf));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      break;
+    Data.append(Buf, (size_t)N);
+  }
+  ::close(Fd);
+
+  Cursor C = {Data.data(), Data.data() + Data.size()};
+  uint32_t Header[2];
+  if (!C.take(Header, sizeof(Header)) || Header[0] != FI_RESULTS_MAGIC) {
+    Error = "'" + Path + "' is not a results file";
+    return false;
+  }
+  if (Header[1] != FI_RESULTS_VERSION) {
+    Error = "'" + Path + "' has unsupported version " + std::to_string(Header[1]);
+    return false;
+  }
+
+  while (C.Pos < C.End) {
+    uint32_t Head[2];
+    if (!C.take(Head, sizeof(Head)))
+      break;
+    uint32_t Rows = Head[1];
+    if (Head[0] == FI_BLOCK_STRINGS) {
+      for (uint32_t I = 0; I < Rows; ++I) {
+        uint32_t Fields[2];
+        if (!C.take(Fields, sizeof(Fields)) ||
+            (size_t)(C.End - C.Pos) < Fields[1])
+          return true; // Truncated tail
+        DetectionNames[Fields[0]].assign(C.Pos, Fields[1]);
+        C.Pos += Fields[1];
+      }
+    } else if (Head[0] == FI_BLOCK_TRIALS) {
+      size_t RowBytes = 4 + 1 + 1 + 1 + 4 + 8;
+      if ((size_t)(C.End - C.Pos) < (size_t)Rows * RowBytes)
+        return true; // Truncated tail
+      C.column(Sites, Rows);
+      C.column(Models, Rows);
+      C.column(Bits, Rows);
+      C.column(Outcomes, Rows);
+      C.column(Detections, Rows);
+      C.column(Latencies, Rows);
+    } else {
+      Error = "'" + Path + "' contains an unknown block kind";
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,98 @@
+// FIResultsStore.h
+// Append-only columnar store for fault injection trial results
+//
+// Written by fi-campaign (--results) and read by fi-analyze. A file is a
+// header followed by self-contained blocks, so campaigns can keep appending
+// to the same file and a truncated tail only loses the last block:
+//
+//   header:  "FIRS" magic, uint32 version
+//   block:   uint32 kind, uint32 rows, then the payload
+//     FI_BLOCK_TRIALS   one column at a time: site u32[rows], model u8[rows],
+//                       bit u8[rows], outcome u8[rows], detection u32[rows],
+//                       latency u64[rows]
+//     FI_BLOCK_STRINGS  rows x (u32 id, u32 length, bytes): names of
+//                       detection IDs ("type<TAB>location")
+//
+// All integers are little-endian (host order on supported targets).
+
+#ifndef FI_RESULTS_STORE_H
+#define FI_RESULTS_STORE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define FI_RESULTS_MAGIC   0x53524946u  // "FIRS"
+#define FI_RESULTS_VERSION 1u
+
+// Trial outcomes
+enum Outcome {
+  OUTCOME_NOT_INJECTED,  // The site/instance was never reached
+  OUTCOME_MASKED,        // Same exit status and output as the golden run
+  OUTCOME_SDC,           // Silent data corruption: output or exit code differs
+  OUTCOME_DETECTED,      // A hardening check fired
+  OUTCOME_CRASH,         // Terminated by a signal
+  OUTCOME_HANG,          // Killed after exceeding the trial timeout
+  NUM_OUTCOMES
+};
+
+const char *outcomeName(int O);
+const char *modelName(uint32_t Model);
+
+enum FIResultsBlockKind : uint32_t {
+  FI_BLOCK_TRIALS = 1,
+  FI_BLOCK_STRINGS = 2
+};
+
+// One trial, as stored
+struct FITrialRecord {
+  uint32_t Site = 0;
+  uint8_t Model = 0;      // fi_fault_model_t
+  uint8_t Bit = 0;
+  uint8_t Outcome = 0;    // fi-campaign outcome index
+  uint32_t Detection = 0; // 0 = no check fired
+  uint64_t Latency = 0;   // Site executions from injection to detection
+};
+
+// Stable detection ID for a "type<TAB>location" string (never 0)
+uint32_t fiDetectionID(const std::string &Detection);
+
+class FIResultsWriter {
+  int Fd = -1;
+  std::vector<uint32_t> Sites;
+  std::vector<uint8_t> Models, Bits, Outcomes;
+  std::vector<uint32_t> Detections;
+  std::vector<uint64_t> Latencies;
+  std::vector<std::pair<uint32_t, std::string>> PendingStrings;
+  std::unordered_set<uint32_t> KnownStrings;
+
+public:
+  static const size_t BlockRows = 65536;
+
+  ~FIResultsWriter() { close(); }
+
+  // Opens Path for appending, writing the header if the file is new
+  bool open(const std::string &Path);
+  // Detection is the "type<TAB>location" string, or empty
+  void add(FITrialRecord Record, const std::string &Detection);
+  bool flush();
+  void close();
+};
+
+// Whole-file reader: columns of every trial block, concatenated
+struct FIResultsTable {
+  std::vector<uint32_t> Sites;
+  std::vector<uint8_t> Models, Bits, Outcomes;
+  std::vector<uint32_t> Detections;
+  std::vector<uint64_t> Latencies;
+  std::unordered_map<uint32_t, std::string> DetectionNames;
+
+  size_t size() const { return Sites.size(); }
+
+  // Appends the contents of Path; Error describes the first problem
+  bool load(const std::string &Path, std::string &Error);
+};
+
+#endif // FI_RESULTS_STORE_H
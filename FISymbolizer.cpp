@@ -0,0 +1,141 @@
+// FISymbolizer.cpp
+// Offline detection trace symbolizer (fi-symbolize)
+//
+// Hardened binaries never format source positions: each check passes a
+// constant "function:kind#ID" location, and with FI_TRACE_OUT set the
+// runtime appends a fixed-size fi_trace_record_t per failed check. This
+// tool joins those records with the site table written by
+// -fi-harden-site-table and prints where every detection happened.
+//
+// Usage:
+//   fi-symbolize --site-table checks.tsv [--format text|csv] [-o out] trace.bin...
+
+#include "FIHardeningRuntime.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct CheckSite {
+  std::string Kind;
+  std::string Function;
+  std::string Location;  // file:line:col, or "-" without debug info
+};
+
+// Check ID -> site, from the -fi-harden-site-table file
+bool loadSiteTable(const std::string &Path, std::vector<CheckSite> &Sites) {
+  std::ifstream In(Path);
+  if (!In) {
+    fprintf(stderr, "fi-symbolize: cannot open site table '%s'\n", Path.c_str());
+    return false;
+  }
+  std::string Line;
+  while (std::getline(In, Line)) {
+    if (Line.empty() || Line[0] == '#')
+      continue;
+    std::istringstream Fields(Line);
+    std::string ID;
+    CheckSite Site;
+    std::getline(Fields, ID, '\t');
+    std::getline(Fields, Site.Kind, '\t');
+    std::getline(Fields, Site.Function, '\t');
+    std::getline(Fields, Site.Location, '\t');
+    unsigned long Check = strtoul(ID.c_str(), nullptr, 10);
+    if (Check >= Sites.size())
+      Sites.resize(Check + 1);
+    Sites[Check] = Site;
+  }
+  return true;
+}
+
+void printUsage() {
+  fprintf(stderr,
+          "Usage: fi-symbolize --site-table FILE [options] <trace>...\n"
+          "  --site-table FILE    Site table written by -fi-harden-site-table\n"
+          "  --format text|csv    Output format (default text)\n"
+          "  -o FILE              Write to FILE instead of stdout\n");
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  std::string SiteTablePath, OutputPath, Format = "text";
+  std::vector<std::string> Inputs;
+  for (int I = 1; I < argc; ++I) {
+    std::string Arg = argv[I];
+    if (Arg == "--site-table" && I + 1 < argc)
+      SiteTablePath = argv[++I];
+    else if (Arg == "--format" && I + 1 < argc)
+      Format = argv[++I];
+    else if (Arg == "-o" && I + 1 < argc)
+      OutputPath = argv[++I];
+    else if (!Arg.empty() && Arg[0] == '-') {
+      printUsage();
+      return 2;
+    } else
+      Inputs.push_back(Arg);
+  }
+  if (Inputs.empty() || SiteTablePath.empty() ||
+      (Format != "text" && Format != "csv")) {
+    printUsage();
+    return 2;
+  }
+
+  std::vector<CheckSite> Sites;
+  if (!loadSiteTable(SiteTablePath, Sites))
+    return 2;
+
+  FILE *Out = stdout;
+  if (!OutputPath.empty() && !(Out = fopen(OutputPath.c_str(), "w"))) {
+    fprintf(stderr, "fi-symbolize: cannot write '%s'\n", OutputPath.c_str());
+    return 1;
+  }
+  if (Format == "csv")
+    fprintf(Out, "pid,sequence,type,check,kind,function,location\n");
+
+  static const CheckSite Unknown = {"unknown", "unknown", "-"};
+  size_t Records = 0, Unresolved = 0;
+  for (const std::string &Path : Inputs) {
+    FILE *In = fopen(Path.c_str(), "rb");
+    if (!In) {
+      fprintf(stderr, "fi-symbolize: cannot open '%s'\n", Path.c_str());
+      return 1;
+    }
+    fi_trace_record_t R;
+    while (fread(&R, sizeof(R), 1, In) == 1) {
+      if (R.magic != FI_TRACE_MAGIC) {
+        fprintf(stderr, "fi-symbolize: '%s' is not a detection trace\n", Path.c_str());
+        break;
+      }
+      char Type[sizeof(R.type) + 1] = {};
+      memcpy(Type, R.type, sizeof(R.type));
+      bool Known = R.check < Sites.size() && !Sites[R.check].Kind.empty();
+      const CheckSite &Site = Known ? Sites[R.check] : Unknown;
+      Records++;
+      Unresolved += !Known;
+
+      std::string Check = R.check == FI_TRACE_NO_CHECK ? "-" : std::to_string(R.check);
+      if (Format == "csv")
+        fprintf(Out, "%u,%llu,%s,%s,\"%s\",\"%s\",\"%s\"\n", R.pid,
+                (unsigned long long)R.sequence, Type, Check.c_str(),
+                Site.Kind.c_str(), Site.Function.c_str(), Site.Location.c_str());
+      else
+        fprintf(Out, "%s: %s check #%s (%s in %s) failed in pid %u after %llu verifications\n",
+                Site.Location.c_str(), Type, Check.c_str(), Site.Kind.c_str(),
+                Site.Function.c_str(), R.pid, (unsigned long long)R.sequence);
+    }
+    fclose(In);
+  }
+  if (Out != stdout)
+    fclose(Out);
+
+  fprintf(stderr, "fi-symbolize: %zu record(s), %zu without a site table entry\n",
+          Records, Unresolved);
+  return 0;
+}
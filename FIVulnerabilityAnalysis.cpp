@@ -0,0 +1,288 @@
+// FIVulnerabilityAnalysis.cpp
+// Fault-impact analysis shared by fi-harden and fi-harden-transform
+
+#include "FIVulnerabilityAnalysis.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include <cmath>
+#include <vector>
+
+using namespace llvm;
+
+AnalysisKey FIVulnerabilityAnalysis::Key;
+
+namespace {
+
+// Stack slots that never escape the function, memoized
+class LocalSlots {
+  DenseMap<const AllocaInst *, bool> Escapes;
+
+public:
+  // Slot Ptr points into if that slot never escapes, or null
+  const AllocaInst *get(const Value *Ptr) {
+    auto *AI = dyn_cast<AllocaInst>(getUnderlyingObject(Ptr));
+    if (!AI)
+      return nullptr;
+    auto It = Escapes.find(AI);
+    if (It == Escapes.end())
+      It = Escapes.insert({AI, PointerMayBeCaptured(AI, /*ReturnCaptures=*/true,
+                                                    /*StoreCaptures=*/true)})
+               .first;
+    return It->second ? nullptr : AI;
+  }
+};
+
+// Def-use propagation of fault impact to a fixed point
+class ImpactPropagation {
+  DenseMap<const Instruction *, uint8_t> &Impacts;
+  LocalSlots &Slots;
+  DenseMap<const AllocaInst *, uint8_t> SlotImpacts;  // OR over the slot's loads
+
+  // Impact of a fault in the value used by U
+  uint8_t through(const Use &U) const {
+    const User *Usr = U.getUser();
+    if (isa<BranchInst>(Usr) || isa<SwitchInst>(Usr) || isa<IndirectBrInst>(Usr))
+      return FI_IMPACT_BRANCH;
+    if (isa<ReturnInst>(Usr))
+      return FI_IMPACT_RETURN;
+    if (auto *SI = dyn_cast<StoreInst>(Usr)) {
+      // A corrupted address writes somewhere else entirely
+      if (U.getOperandNo() == SI->getPointerOperandIndex())
+        return FI_IMPACT_ESCAPED_STORE;
+      return Impacts.lookup(SI);
+    }
+    if (auto *CB = dyn_cast<CallBase>(Usr)) {
+      if (auto *II = dyn_cast<IntrinsicInst>(CB))
+        if (II->isLifetimeStartOrEnd() || II->isAssumeLikeIntrinsic())
+          return 0;
+      // Callees may store or return their arguments
+      return (CB->isCallee(&U) ? FI_IMPACT_BRANCH : FI_IMPACT_ESCAPED_STORE) |
+             Impacts.lookup(CB);
+    }
+    if (auto *I = dyn_cast<Instruction>(Usr))
+      return Impacts.lookup(I);
+    return 0;
+  }
+
+  // Impact of a fault in I itself
+  uint8_t compute(const Instruction *I) {
+    if (auto *Br = dyn_cast<BranchInst>(I))
+      return Br->isConditional() ? FI_IMPACT_BRANCH : 0;
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      // Stores to private slots matter as much as the loads that read them
+      const AllocaInst *AI = Slots.get(SI->getPointerOperand());
+      return AI ? SlotImpacts.lookup(AI) : FI_IMPACT_ESCAPED_STORE;
+    }
+    uint8_t Impact = 0;
+    for (const Use &U : I->uses())
+      Impact |= through(U);
+    return Impact;
+  }
+
+public:
+  ImpactPropagation(DenseMap<const Instruction *, uint8_t> &Impacts,
+                    LocalSlots &Slots)
+      : Impacts(Impacts), Slots(Slots) {}
+
+  void run(Function &F) {
+    std::vector<Instruction *> Order;
+    for (Instruction &I : instructions(F)) {
+      Order.push_back(&I);
+      Impacts[&I] = 0;
+    }
+
+    // Users mostly follow their operands, so reverse order converges fast
+    bool Changed = true;
+    while (Changed) {
+      Changed = false;
+      for (auto It = Order.rbegin(), E = Order.rend(); It != E; ++It) {
+        Instruction *I = *It;
+        uint8_t Impact = compute(I);
+        uint8_t &Known = Impacts[I];
+        if ((Known | Impact) != Known) {
+          Known |= Impact;
+          Changed = true;
+        }
+        if (auto *LI = dyn_cast<LoadInst>(I))
+          if (const AllocaInst *AI = Slots.get(LI->getPointerOperand())) {
+            uint8_t &Slot = SlotImpacts[AI];
+            if ((Slot | Impact) != Slot) {
+              Slot |= Impact;
+              Changed = true;
+            }
+          }
+      }
+    }
+  }
+};
+
+// Where an SDC estimate ends: probabilities that a corrupted value reaching
+// each kind of sink changes the program's output without being detected
+const float BranchSDC = 0.5f;        // Control divergence
+const float ReturnSDC = 0.7f;        // Unknown use by the caller
+const float EscapedStoreSDC = 0.8f;  // Globals, heap, escaped stack
+const float CallArgumentSDC = 0.7f;  // Unknown callee
+const float AddressSDC = 0.2f;       // Wrong address that does not crash
+
+// Library calls that write their arguments to the program's output
+bool isOutputFunction(const Function *F) {
+  if (!F)
+    return false;
+  StringRef Name = F->getName();
+  return Name == "printf" || Name == "puts" || Name == "putchar" ||
+         Name == "fprintf" || Name == "fputs" || Name == "fputc" ||
+         Name == "putc" || Name == "fwrite" || Name == "write";
+}
+
+unsigned bitWidth(const Value *V) {
+  Type *Ty = V->getType();
+  return Ty->isIntegerTy() ? Ty->getIntegerBitWidth() : 64;
+}
+
+// Fraction of single-bit faults in operand OpNo of I that survive into I's
+// result (1 = no masking)
+float propagationFactor(const Instruction *I, unsigned OpNo) {
+  float W = (float)bitWidth(I->getOperand(OpNo));
+  if (auto *BO = dyn_cast<BinaryOperator>(I)) {
+    auto *C = dyn_cast<ConstantInt>(BO->getOperand(1 - OpNo));
+    switch (BO->getOpcode()) {
+    case Instruction::And:
+      return C ? C->getValue().popcount() / W : 0.5f;
+    case Instruction::Or:
+      return C ? (W - C->getValue().popcount()) / W : 0.5f;
+    case Instruction::Shl:
+    case Instruction::LShr:
+    case Instruction::AShr:
+      if (OpNo == 1)
+        return 1.0f;
+      return C ? std::max(0.0f, W - (float)C->getLimitedValue(64)) / W : 0.5f;
+    case Instruction::Mul:
+      return C ? (W - C->getValue().countr_zero()) / W : 1.0f;
+    case Instruction::UDiv:
+    case Instruction::SDiv:
+      if (OpNo == 1)
+        return 1.0f;
+      return C && !C->isZero() ? (W - C->getValue().logBase2()) / W : 0.5f;
+    case Instruction::URem:
+    case Instruction::SRem:
+      if (OpNo == 1)
+        return 1.0f;
+      return C && !C->isZero() ? std::max(1u, C->getValue().logBase2()) / W : 0.5f;
+    default:
+      return 1.0f;
+    }
+  }
+  if (auto *Cmp = dyn_cast<CmpInst>(I))
+    // Equality flips whenever the operands were equal; an ordering only
+    // when the flipped bit lies above the operands' difference
+    return Cmp->isEquality() ? 0.5f : 0.3f;
+  if (isa<TruncInst>(I))
+    return (float)bitWidth(I) / W;
+  if (isa<SelectInst>(I))
+    return 0.5f;
+  return 1.0f;
+}
+
+// Backward propagation of SDC probability to a fixed point
+class SDCPropagation {
+  DenseMap<const Instruction *, float> &P;
+  LocalSlots &Slots;
+  DenseMap<const AllocaInst *, float> SlotP;  // Max over the slot's loads
+
+  // Probability that a fault in the value used by U becomes an SDC via U
+  float through(const Use &U) const {
+    const User *Usr = U.getUser();
+    if (isa<BranchInst>(Usr) || isa<SwitchInst>(Usr) || isa<IndirectBrInst>(Usr))
+      return BranchSDC;
+    if (isa<ReturnInst>(Usr))
+      return ReturnSDC;
+    if (auto *SI = dyn_cast<StoreInst>(Usr)) {
+      if (U.getOperandNo() == SI->getPointerOperandIndex())
+        return AddressSDC;
+      return P.lookup(SI);
+    }
+    if (auto *LI = dyn_cast<LoadInst>(Usr))
+      return AddressSDC * P.lookup(LI);
+    if (auto *CB = dyn_cast<CallBase>(Usr)) {
+      if (auto *II = dyn_cast<IntrinsicInst>(CB))
+        if (II->isLifetimeStartOrEnd() || II->isAssumeLikeIntrinsic())
+          return 0.0f;
+      if (CB->isCallee(&U))
+        return AddressSDC;
+      const Function *Callee = CB->getCalledFunction();
+      // Values handed to the hardening runtime are checked, not output
+      if (Callee && Callee->getName().starts_with("fi_"))
+        return 0.0f;
+      float Arg = isOutputFunction(Callee) ? 1.0f : CallArgumentSDC;
+      return std::max(Arg, P.lookup(CB));
+    }
+    if (auto *I = dyn_cast<Instruction>(Usr))
+      return propagationFactor(I, U.getOperandNo()) * P.lookup(I);
+    return 0.0f;
+  }
+
+  float compute(const Instruction *I) {
+    if (auto *Br = dyn_cast<BranchInst>(I))
+      return Br->isConditional() ? BranchSDC : 0.0f;
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      const AllocaInst *AI = Slots.get(SI->getPointerOperand());
+      return AI ? SlotP.lookup(AI) : EscapedStoreSDC;
+    }
+    // Most likely path; a noisy-OR would count loop-carried uses again on
+    // every trip around the loop and saturate every induction variable
+    float Best = 0.0f;
+    for (const Use &U : I->uses())
+      Best = std::max(Best, through(U));
+    return Best;
+  }
+
+public:
+  SDCPropagation(DenseMap<const Instruction *, float> &P, LocalSlots &Slots)
+      : P(P), Slots(Slots) {}
+
+  void run(Function &F) {
+    std::vector<Instruction *> Order;
+    for (Instruction &I : instructions(F)) {
+      Order.push_back(&I);
+      P[&I] = 0.0f;
+    }
+
+    // Monotone from 0, so this converges to the least fixed point
+    for (unsigned Round = 0; Round < 32; ++Round) {
+      float Delta = 0.0f;
+      for (auto It = Order.rbegin(), E = Order.rend(); It != E; ++It) {
+        Instruction *I = *It;
+        float New = compute(I);
+        float &Old = P[I];
+        Delta = std::max(Delta, std::fabs(New - Old));
+        Old = New;
+        if (auto *LI = dyn_cast<LoadInst>(I))
+          if (const AllocaInst *AI = Slots.get(LI->getPointerOperand())) {
+            float &Slot = SlotP[AI];
+            if (New > Slot) {
+              Delta = std::max(Delta, New - Slot);
+              Slot = New;
+            }
+          }
+      }
+      if (Delta < 1e-4f)
+        break;
+    }
+  }
+};
+
+} // anonymous namespace
+
+FIVulnerabilityInfo FIVulnerabilityAnalysis::run(Function &F,
+                                                 FunctionAnalysisManager &FAM) {
+  FIVulnerabilityInfo Info;
+  LocalSlots Slots;
+  ImpactPropagation(Info.Impacts, Slots).run(F);
+  SDCPropagation(Info.Propensities, Slots).run(F);
+  return Info;
+}
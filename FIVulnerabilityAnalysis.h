@@ -0,0 +1,70 @@
+// FIVulnerabilityAnalysis.h
+// Fault-impact analysis shared by fi-harden and fi-harden-transform
+//
+// A function analysis cached by the FunctionAnalysisManager. For every
+// instruction it records where a fault in it can propagate along def-use
+// chains: into a branch condition, into a store to escaped memory (or a
+// call argument), or into a return value. Values stored to non-escaping
+// stack slots propagate to the loads of the same slot.
+//
+// It also estimates each instruction's SDC propensity, the probability that
+// a single bit flip in its result ends as silent data corruption, in the
+// spirit of Trident/ePVF but without a profile: the probability is carried
+// backwards along def-use chains (the most likely use wins), scaled at
+// every use by how many bits of the operand the user can pass on (masking by and/or/shifts/truncation
+// and compares), through memory via private stack slots, and ends in fixed
+// probabilities at branches, returns, escaped stores and calls.
+//
+// Compiled into both plugins; each registers it with its PassBuilder.
+
+#ifndef FI_VULNERABILITY_ANALYSIS_H
+#define FI_VULNERABILITY_ANALYSIS_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/PassManager.h"
+
+// Where a fault in an instruction can end up. Values are weights: an
+// instruction's score is the sum over everything it reaches (0-7).
+enum FIImpact : uint8_t {
+  FI_IMPACT_RETURN = 1,         // A return value
+  FI_IMPACT_ESCAPED_STORE = 2,  // Memory visible outside the function
+  FI_IMPACT_BRANCH = 4          // A branch or switch condition
+};
+
+class FIVulnerabilityInfo {
+  friend class FIVulnerabilityAnalysis;
+  llvm::DenseMap<const llvm::Instruction *, uint8_t> Impacts;
+  llvm::DenseMap<const llvm::Instruction *, float> Propensities;
+
+public:
+  // FIImpact bits of I; 0 for instructions the analysis has not seen
+  uint8_t impact(const llvm::Instruction *I) const { return Impacts.lookup(I); }
+
+  // True if I was analyzed and a fault in it cannot reach anything that
+  // matters. Instructions added after the analysis ran are never safe.
+  bool isSafe(const llvm::Instruction *I) const {
+    auto It = Impacts.find(I);
+    return It != Impacts.end() && It->second == 0;
+  }
+
+  // Estimated probability that a fault in I becomes an SDC, or -1 for
+  // instructions the analysis has not seen
+  float sdcPropensity(const llvm::Instruction *I) const {
+    auto It = Propensities.find(I);
+    return It == Propensities.end() ? -1.0f : It->second;
+  }
+};
+
+class FIVulnerabilityAnalysis
+    : public llvm::AnalysisInfoMixin<FIVulnerabilityAnalysis> {
+  friend llvm::AnalysisInfoMixin<FIVulnerabilityAnalysis>;
+  static llvm::AnalysisKey Key;
+
+public:
+  using Result = FIVulnerabilityInfo;
+
+  Result run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM);
+};
+
+#endif // FI_VULNERABILITY_ANALYSIS_H
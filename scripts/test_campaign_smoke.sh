@@ -0,0 +1,79 @@
+#!/usr/bin/env bash
+
+# End-to-end smoke test of fi-inject, fi-campaign and fi-analyze
+# Usage:
+#   ./scripts/test_campaign_smoke.sh [build-dir]    (default ./build)
+#
+# Builds tests/fi_campaign_smoke.c with fi-inject, checks the uninjected
+# output, then runs one fi-campaign trial with a fault the program masks
+# and one inverting the branch that selects the output. Both go through
+# the fork server, the outcome classification and a results store, and
+# fi-analyze must report the first as masked and the second as SDC or
+# detected.
+
+set -e
+
+BUILD_DIR=${1:-./build}
+CLANG=${CLANG:-clang}
+CLANGXX=${CLANGXX:-clang++}
+OPT=${OPT:-opt}
+SOURCE=tests/fi_campaign_smoke.c
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+for Built in FIHardeningTransform.so libFIHardeningRuntime.a fi-campaign fi-analyze; do
+    [ -e "$BUILD_DIR/$Built" ] || fail "$BUILD_DIR/$Built not found; build the project first"
+done
+
+# Instrument and link
+"$CLANG" -g -O0 -S -emit-llvm -o "$WORK/smoke.ll" "$SOURCE"
+"$OPT" -load-pass-plugin="$BUILD_DIR/FIHardeningTransform.so" -passes=fi-inject \
+    -fi-inject-site-map="$WORK/sites.tsv" "$WORK/smoke.ll" -o "$WORK/smoke.bc" 2>/dev/null
+"$CLANGXX" "$WORK/smoke.bc" "$BUILD_DIR/libFIHardeningRuntime.a" -lpthread -o "$WORK/smoke"
+
+# Without FI_INJECT_SITE the instrumented program runs fault-free
+[ "$("$WORK/smoke")" = "ok 4608" ] || fail "uninjected run printed the wrong output"
+
+# Site ID of the first site of a kind and opcode on a marked source line
+site_on_line() {
+    local Line
+    Line=$(grep -n "SMOKE: $1" "$SOURCE" | cut -d: -f1)
+    awk -F'\t' -v kind="$2" -v op="$3" -v line=":$Line:" \
+        '$2 == kind && $4 == op && index($6, line) { print $1; exit }' "$WORK/sites.tsv"
+}
+MASKED_SITE=$(site_on_line masked value load)
+BRANCH_SITE=$(site_on_line branch branch br)
+[ -n "$MASKED_SITE" ] || fail "no value site for the masked load in the site map"
+[ -n "$BRANCH_SITE" ] || fail "no branch site in the site map"
+
+# One trial each; the summary line is "  <outcome>  <count> ..."
+run_trial() {
+    "$BUILD_DIR/fi-campaign" --site-map "$WORK/sites.tsv" --site "$1" --bit 0 \
+        --jobs 1 --results "$WORK/$2.firs" -- "$WORK/smoke" > "$WORK/$2.txt" ||
+        fail "fi-campaign failed for site $1"
+}
+count_of() {
+    awk -v outcome="$2" '$1 == outcome { print $2 }' "$WORK/$1.txt"
+}
+run_trial "$MASKED_SITE" masked
+run_trial "$BRANCH_SITE" branch
+
+[ "$(count_of masked masked)" = 1 ] || fail "masked load fault not classified as masked"
+BRANCH_CAUGHT=$(( $(count_of branch sdc) + $(count_of branch detected) ))
+[ "$BRANCH_CAUGHT" = 1 ] || fail "branch inversion not classified as SDC or detected"
+
+# The same outcomes through the results store: table,key,injected,masked,sdc,detected,...
+"$BUILD_DIR/fi-analyze" --site-map "$WORK/sites.tsv" "$WORK/masked.firs" > "$WORK/masked.csv"
+"$BUILD_DIR/fi-analyze" --site-map "$WORK/sites.tsv" "$WORK/branch.firs" > "$WORK/branch.csv"
+grep -q '^model,"bitflip",1,1,' "$WORK/masked.csv" ||
+    fail "fi-analyze does not report the load fault as masked"
+grep -Eq '^model,"branch",1,0,(1,0|0,1),' "$WORK/branch.csv" ||
+    fail "fi-analyze does not report the branch inversion as SDC or detected"
+
+echo "PASS: fi-inject -> fi-campaign -> fi-analyze"
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+
+# Check that -fi-harden-diverse shadows survive optimization
+# Usage:
+#   ./scripts/test_diverse_shadow.sh [build-dir]    (default ./build)
+#
+# Hardens tests/fi_diverse_shadow.c at level 3 with diverse shadows, runs
+# -O2 over the result and fails if any check ended up comparing a value
+# with itself, i.e. InstCombine or CSE folded a shadow back into its
+# original.
+
+set -e
+
+BUILD_DIR=${1:-./build}
+CLANG=${CLANG:-clang}
+OPT=${OPT:-opt}
+SOURCE=tests/fi_diverse_shadow.c
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+[ -e "$BUILD_DIR/FIHardeningTransform.so" ] ||
+    fail "$BUILD_DIR/FIHardeningTransform.so not found; build the project first"
+
+"$CLANG" -O0 -Xclang -disable-O0-optnone -S -emit-llvm -o "$WORK/diverse.ll" "$SOURCE"
+"$OPT" -load-pass-plugin="$BUILD_DIR/FIHardeningTransform.so" \
+    -passes='function(mem2reg,fi-harden-transform),default<O2>' \
+    -fi-harden-level=3 -fi-harden-diverse "$WORK/diverse.ll" -S -o "$WORK/diverse.O2.ll" 2>/dev/null
+
+CHECKS=$(grep -c 'call void @fi_verify_' "$WORK/diverse.O2.ll" || true)
+MERGED=$(grep -E '@fi_verify_[a-z0-9]+\((i[0-9]+|ptr) (%[A-Za-z0-9._]+), (i[0-9]+|ptr) \2,' \
+             "$WORK/diverse.O2.ll" || true)
+[ "$CHECKS" -gt 0 ] || fail "no checks left after -O2"
+[ -z "$MERGED" ] || fail "shadows merged with their originals after -O2:
+$MERGED"
+
+echo "PASS: $CHECKS checks still compare separate shadows after -O2"
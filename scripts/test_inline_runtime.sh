@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+
+# Check that -fi-harden-inline-runtime links every verify fast path
+# Usage:
+#   ./scripts/test_inline_runtime.sh [build-dir]    (default ./build)
+#
+# Builds FIHardeningRuntime.bc the way CMake does, hardens
+# tests/fi_inline_runtime.c (which calls all four fi_verify_* functions)
+# with the bitcode and fails unless the pass reports all four as linked,
+# i.e. none of them was rejected for touching the runtime's private state.
+
+set -e
+
+BUILD_DIR=${1:-./build}
+CLANG=${CLANG:-clang}
+CLANGXX=${CLANGXX:-clang++}
+OPT=${OPT:-opt}
+SOURCE=tests/fi_inline_runtime.c
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+[ -e "$BUILD_DIR/FIHardeningTransform.so" ] ||
+    fail "$BUILD_DIR/FIHardeningTransform.so not found; build the project first"
+
+"$CLANGXX" -O2 -std=c++17 -fno-exceptions -emit-llvm -c \
+    -o "$WORK/FIHardeningRuntime.bc" FIHardeningRuntime.cpp
+"$CLANG" -O0 -Xclang -disable-O0-optnone -S -emit-llvm -o "$WORK/inline.ll" "$SOURCE"
+"$OPT" -load-pass-plugin="$BUILD_DIR/FIHardeningTransform.so" \
+    -passes='function(mem2reg),fi-harden-transform' \
+    -fi-harden-inline-runtime="$WORK/FIHardeningRuntime.bc" \
+    "$WORK/inline.ll" -S -o "$WORK/inline.hardened.ll" 2> "$WORK/opt.log"
+
+grep -q '\[InlineRuntime\] Linked 4 verify fast path(s)' "$WORK/opt.log" ||
+    fail "not all verify fast paths were linked:
+$(grep '\[InlineRuntime\]' "$WORK/opt.log")"
+
+echo "PASS: all 4 verify fast paths linked from FIHardeningRuntime.bc"
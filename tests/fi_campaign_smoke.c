@@ -0,0 +1,17 @@
+// Smoke target for scripts/test_campaign_smoke.sh
+//
+// Built at -O0 with -g so that the script can find its injection sites by
+// source line: a load whose low bit the program masks off, and the branch
+// that selects the output.
+
+#include <stdio.h>
+
+int main(void) {
+  volatile unsigned seed = 0x1234;
+  unsigned high = seed & 0xff00;  // SMOKE: masked (bit 0 of the load)
+  if (high == 0x1200)             // SMOKE: branch
+    printf("ok %u\n", high);
+  else
+    printf("flipped %u\n", high);
+  return 0;
+}
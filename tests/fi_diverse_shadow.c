@@ -0,0 +1,19 @@
+// Target for scripts/test_diverse_shadow.sh
+//
+// One operation of every kind -fi-harden-diverse has a form for, plus a
+// division (TMR without a diverse form) and two compares feeding branches.
+// There are no values merged at a join, so every check the script looks at
+// compares an original with its shadow.
+
+void fi_diverse_sink(unsigned value);
+
+unsigned fi_diverse_mix(unsigned a, unsigned b) {
+  unsigned r = (a + b) ^ (a - b);
+  r = (r | b) & (a * b);
+  r += a * 8 + a / (b | 1);
+  if (a == b)
+    fi_diverse_sink(r);
+  if ((int)a < (int)b)
+    fi_diverse_sink(r + 1);
+  return r;
+}
@@ -0,0 +1,18 @@
+// Target for scripts/test_inline_runtime.sh
+//
+// One load of each width the verify fast paths cover (int32, int64,
+// pointer) and a branch, so hardening calls all four fi_verify_* functions.
+
+#include <stdint.h>
+
+int32_t fi_inline_int;
+int64_t fi_inline_long;
+int32_t *fi_inline_ptr = &fi_inline_int;
+
+int64_t fi_inline_read(void) {
+  int32_t *p = fi_inline_ptr;
+  int64_t r = fi_inline_long;
+  if (fi_inline_int > 0)
+    r += *p;
+  return r;
+}